@@ -0,0 +1,399 @@
+#!/usr/bin/python
+
+# Scatter-gather over every Pico at once - one query goes out to all of them in parallel and the answers come back as one result
+# Row results are fetched as binary frames and merged as they stream in: a k-way merge on the ORDER BY columns when there are any,
+# otherwise rows are passed on in whatever order they arrive. LIMIT k OFFSET m goes to every Pico as LIMIT k+m, since any of
+# them could hold all of the rows wanted, and the OFFSET and LIMIT are applied to the merged rows. Aggregates are rewritten into parts that recombine (AVG becomes
+# SUM and COUNT) and the parts from every Pico are folded together per group. PERCENTILE and HISTOGRAM are worked out from
+# every Pico's potv histogram added together, which is exact and never moves a row.
+# Everything talks to plain serial port paths, so pty-backed fake Picos work as well as /dev/ttyACM*.
+
+import asyncio, glob, heapq, re, sys, time
+from concurrent.futures import ThreadPoolExecutor
+import serial
+from result_decoder import read_header, read_blocks
+
+COLUMN_ORDER = ["time", "potv", "butp", "ledo"]
+MAX_AGGS = 4    # Aggregates the Pico takes in one SELECT
+QUERY = re.compile(r"SELECT (?P<select>\S+)(?: WHERE (?P<where>\S+))?(?: GROUP BY (?P<group>\S+))?"
+                   r"(?: ORDER BY (?P<order>\S+)(?P<desc> DESC)?)?(?: LIMIT (?P<limit>[0-9]+)(?: OFFSET (?P<offset>[0-9]+))?)?"
+                   r"(?: FORMAT BINARY)?$")
+AGG = re.compile(r"(COUNT|MIN|MAX|SUM|AVG)\((\*|time|potv|butp|ledo)\)$")
+HIST_AGG = re.compile(r"(PERCENTILE|HISTOGRAM)\(potv(?:,([0-9.]+))?\)$")
+ADC_LEVELS = 4096
+HIST_BIN_LEVELS = 64    # HISTOGRAM bin width when none is given
+
+class QueryError(Exception):
+    pass
+
+def parse_query(query):
+    # Splits a query into (select list, WHERE clause or None, GROUP BY clause or None, ORDER BY columns, DESC,
+    # LIMIT or None, OFFSET)
+    match = QUERY.match(query.strip())
+    if match is None:
+        raise QueryError("Could not parse %r" % query)
+    order = match.group("order").split(",") if match.group("order") else []
+    # Commas inside brackets belong to the aggregate - PERCENTILE(potv,0.99)
+    select = re.split(r",(?![^(]*\))", match.group("select"))
+    limit = int(match.group("limit")) if match.group("limit") else None
+    offset = int(match.group("offset") or 0)
+    return select, match.group("where"), match.group("group"), order, match.group("desc") is not None, limit, offset
+
+def build_query(select, where, group = None, order = (), desc = False, limit = None, offset = 0, binary = False):
+    query = "SELECT " + ",".join(select)
+    if where:
+        query += " WHERE " + where
+    if group:
+        query += " GROUP BY " + group
+    if order:
+        query += " ORDER BY " + ",".join(order)
+        if desc:
+            query += " DESC"
+    if limit is not None:
+        query += " LIMIT %d" % limit
+        if offset:
+            query += " OFFSET %d" % offset
+    if binary:
+        query += " FORMAT BINARY"
+    return query
+
+def parse_fraction(text):
+    # PERCENTILE's fraction in millionths, read the way the Pico reads it - the median when there is none
+    if text is None:
+        return 500000
+    whole, _, frac = text.partition(".")
+    if int(whole or "0") >= 1:
+        return 1000000
+    return int((frac + "000000")[:6])
+
+def format_fraction(millionths):
+    # Same as the Pico's result header - percentile(potv,0.99)
+    if millionths == 1000000:
+        return "1"
+    return ("0." + ("%06d" % millionths).rstrip("0")) if millionths else "0"
+
+def percentile(levels, total, millionths):
+    # Nearest rank over a {level: rows} histogram, same as the Pico's hist_percentile
+    rank = max(1, (millionths * total + 999999) // 1000000)
+    for level in sorted(levels):
+        if levels[level] >= rank:
+            return level
+        rank -= levels[level]
+    return max(levels)
+
+def format_avg(total, count):
+    # Same rounding as the Pico - two decimals, halves round up
+    scaled = (total * 100 + count // 2) // count
+    return "%d.%02d" % (scaled // 100, scaled % 100)
+# ============================================================
+
+# ============================================================
+# Blocking serial work - each of these runs on its own thread so every Pico is read at the same time
+def send(ser, command):
+    ser.reset_input_buffer()
+    ser.write((command + "\n").encode())
+
+def fetch_rows(ser, command, put):
+    # Sends a FORMAT BINARY query and hands each block of rows to put as it arrives
+    send(ser, command)
+    num_rows, mask, names = read_header(ser)
+    blocks = read_blocks(ser, num_rows, mask)
+    while True:
+        try:
+            put(next(blocks))
+        except StopIteration as done:
+            return done.value
+
+def fetch_text_result(ser, command):
+    # Sends an aggregate query and returns (header names, rows as lists of strings, microseconds the Pico reported)
+    send(ser, command)
+    line = b""
+    while not line.startswith(b"Aggregating over array size"):
+        line = ser.readline()
+        if len(line) == 0:
+            raise QueryError("No answer from %s" % ser.port)
+    names = ser.readline().decode().strip().split(", ")
+    rows = []
+    while True:
+        line = ser.readline().decode()
+        if len(line) == 0:
+            raise QueryError("Answer from %s cut off" % ser.port)
+        if line.startswith("Time to query: "):
+            return names, rows, int(line.split(": ")[1])
+        rows.append(line.strip().split(", "))
+# ============================================================
+
+# ============================================================
+class Coordinator:
+    def __init__(self, ports, baud = 115200, timeout = 10):
+        self.ports = list(ports)
+        self.baud = baud
+        self.timeout = timeout
+        self.nodes = []
+        self.pool = ThreadPoolExecutor(max_workers = max(1, len(self.ports)))
+        self.node_us = []   # Microseconds each Pico reported for the last query, in port order
+
+    async def open(self):
+        loop = asyncio.get_running_loop()
+        opening = [loop.run_in_executor(self.pool, lambda port = port: serial.Serial(port, self.baud, timeout = self.timeout))
+                   for port in self.ports]
+        self.nodes = await asyncio.gather(*opening)
+
+    def close(self):
+        for ser in self.nodes:
+            ser.close()
+        self.pool.shutdown()
+
+    async def stream(self, query):
+        # Async generator of result rows - the first row comes out as soon as it can be known to be next
+        # Returns the result's column names through self.names before the first row
+        select, where, group, order, desc, limit, offset = parse_query(query)
+        if any(HIST_AGG.match(item) for item in select):
+            names, rows = await self.histogram(select, where, group)
+            self.names = names
+            for row in rows:
+                yield row
+            return
+        if any("(" in item for item in select):
+            names, rows = await self.aggregate(select, where, group)
+            self.names = names
+            for row in rows:
+                yield row
+            return
+        columns = COLUMN_ORDER if select == ["*"] else [c for c in COLUMN_ORDER if c in select]
+        # The ORDER BY columns have to come back to merge on, even if they were not asked for
+        fetched = [c for c in COLUMN_ORDER if c in columns or c in order]
+        picked = [fetched.index(c) for c in columns]
+        keys = [fetched.index(c) for c in order]
+        self.names = columns
+
+        loop = asyncio.get_running_loop()
+        queues = [asyncio.Queue() for _ in self.nodes]
+        # Every Pico could hold the whole page, so each one sends the first k+m rows of its own answer
+        command = build_query(fetched, where, order = order, desc = desc, limit = None if limit is None else limit + offset,
+                              binary = True)
+        def run(index, ser):
+            put = lambda block: loop.call_soon_threadsafe(queues[index].put_nowait, ("rows", block))
+            try:
+                elapsed = fetch_rows(ser, command, put)
+                loop.call_soon_threadsafe(queues[index].put_nowait, ("end", elapsed))
+            except Exception as error:
+                loop.call_soon_threadsafe(queues[index].put_nowait, ("error", error))
+        self.node_us = [0] * len(self.nodes)
+        for index, ser in enumerate(self.nodes):
+            loop.run_in_executor(self.pool, run, index, ser)
+
+        # DESC flips every key on the Pico, so the merge takes the largest first by going on the negated values
+        sign = -1 if desc else 1
+        if keys:
+            rows = merge_sorted([self.node_rows(index, queue) for index, queue in enumerate(queues)],
+                                lambda row: tuple(sign * row[k] for k in keys))
+        else:
+            rows = merge_arrivals(queues, self.node_us)
+        # Rows past the LIMIT are still read, so every Pico has finished its answer before the next query goes out
+        position = 0
+        async for row in rows:
+            if position >= offset and (limit is None or position < offset + limit):
+                yield tuple(row[i] for i in picked)
+            position += 1
+
+    async def node_rows(self, index, queue):
+        # Rows from one Pico in the order it sent them
+        while True:
+            kind, value = await queue.get()
+            if kind == "rows":
+                for row in value:
+                    yield row
+            elif kind == "end":
+                self.node_us[index] = value
+                return
+            else:
+                raise value
+
+    async def aggregate(self, select, where, group):
+        # Sends every Pico the partial aggregates and folds them together per group
+        wanted = []
+        for item in select:
+            match = AGG.match(item)
+            if match is None:
+                raise QueryError("Cannot mix %r with aggregates" % item)
+            wanted.append((match.group(1), match.group(2)))
+        parts = []
+        for func, col in wanted:
+            needs = [("SUM", col), ("COUNT", "*")] if func == "AVG" else [(func, "*" if func == "COUNT" else col)]
+            for part in needs:
+                if part not in parts:
+                    parts.append(part)
+        if len(parts) > MAX_AGGS:
+            raise QueryError("%d partial aggregates needed, the Pico takes %d" % (len(parts), MAX_AGGS))
+        command = build_query(["%s(%s)" % part for part in parts], where, group = group)
+
+        loop = asyncio.get_running_loop()
+        answers = await asyncio.gather(*[loop.run_in_executor(self.pool, fetch_text_result, ser, command) for ser in self.nodes])
+        self.node_us = [elapsed for _, _, elapsed in answers]
+
+        # group value -> one running value per part
+        merged = {}
+        grouped = group is not None
+        for _, rows, _ in answers:
+            for row in rows:
+                key = int(row[0]) if grouped else None
+                values = row[1:] if grouped else row
+                totals = merged.setdefault(key, [None] * len(parts))
+                for p, ((func, _), text) in enumerate(zip(parts, values)):
+                    if text == "NULL":
+                        continue
+                    value = int(text)
+                    old = totals[p]
+                    if old is None:
+                        totals[p] = value
+                    elif func in ("COUNT", "SUM"):
+                        totals[p] = old + value
+                    elif func == "MIN":
+                        totals[p] = min(old, value)
+                    else:
+                        totals[p] = max(old, value)
+        if not grouped and None not in merged:
+            merged[None] = [None] * len(parts)
+
+        names = ([group.split("/")[0]] if grouped else []) + ["%s(%s)" % (func.lower(), col) for func, col in wanted]
+        result = []
+        for key in sorted(merged, key = lambda k: -1 if k is None else k):
+            totals = merged[key]
+            row = [key] if grouped else []
+            for func, col in wanted:
+                if func == "AVG":
+                    total = totals[parts.index(("SUM", col))]
+                    count = totals[parts.index(("COUNT", "*"))]
+                    row.append(format_avg(total, count) if count else None)
+                elif func == "COUNT":
+                    row.append(totals[parts.index(("COUNT", "*"))] or 0)
+                else:
+                    row.append(totals[parts.index((func, col))])
+            result.append(tuple(row))
+        return names, result
+
+    async def histogram(self, select, where, group):
+        # Every Pico sends its potv histogram, they are added up bin by bin, and the answer is worked out from the sum
+        # PERCENTILE and anything next to it needs one bin per level, a HISTOGRAM on its own only the bins it asked for
+        if where or group:
+            raise QueryError("PERCENTILE and HISTOGRAM run over the whole table, without WHERE or GROUP BY")
+        hist = HIST_AGG.match(select[0])
+        alone = len(select) == 1 and hist.group(1) == "HISTOGRAM"
+        if alone:
+            width = min(int(hist.group(2) or 0) or HIST_BIN_LEVELS, ADC_LEVELS)
+        else:
+            width = 1
+            for item in select:
+                match = AGG.match(item)
+                if not HIST_AGG.match(item) and (match is None or match.group(2) not in ("*", "potv")):
+                    raise QueryError("Cannot mix %r with PERCENTILE or HISTOGRAM" % item)
+                if item.startswith("HISTOGRAM"):
+                    raise QueryError("HISTOGRAM has to be on its own")
+        command = build_query(["HISTOGRAM(potv,%d)" % width], None)
+
+        loop = asyncio.get_running_loop()
+        answers = await asyncio.gather(*[loop.run_in_executor(self.pool, fetch_text_result, ser, command) for ser in self.nodes])
+        self.node_us = [elapsed for _, _, elapsed in answers]
+        levels = {}
+        for _, rows, _ in answers:
+            for start, rows_in in rows:
+                levels[int(start)] = levels.get(int(start), 0) + int(rows_in)
+        if alone:
+            return ["potv", "count(*)"], sorted(levels.items())
+
+        total = sum(levels.values())
+        names = []
+        row = []
+        for item in select:
+            match = HIST_AGG.match(item)
+            if match is not None:
+                millionths = parse_fraction(match.group(2))
+                names.append("percentile(potv,%s)" % format_fraction(millionths))
+                row.append(percentile(levels, total, millionths) if total else None)
+                continue
+            func, col = AGG.match(item).groups()
+            names.append("%s(%s)" % (func.lower(), col))
+            if func == "COUNT":
+                row.append(total)
+            elif not total:
+                row.append(None)
+            elif func == "MIN":
+                row.append(min(levels))
+            elif func == "MAX":
+                row.append(max(levels))
+            else:
+                value_sum = sum(level * rows_in for level, rows_in in levels.items())
+                row.append(value_sum if func == "SUM" else format_avg(value_sum, total))
+        return names, [tuple(row)]
+
+    async def query(self, query):
+        # Runs one query on every Pico and returns (column names, rows)
+        rows = [row async for row in self.stream(query)]
+        return self.names, rows
+# ============================================================
+
+# ============================================================
+# Merges
+async def merge_sorted(sources, key):
+    # k-way merge of async row sources that are each already sorted on key - ties go to the lower numbered Pico
+    heap = []
+    for index, source in enumerate(sources):
+        try:
+            row = await source.__anext__()
+            heap.append((key(row), index, row))
+        except StopAsyncIteration:
+            pass
+    heapq.heapify(heap)
+    while heap:
+        _, index, row = heap[0]
+        yield row
+        try:
+            nxt = await sources[index].__anext__()
+            heapq.heapreplace(heap, (key(nxt), index, nxt))
+        except StopAsyncIteration:
+            heapq.heappop(heap)
+
+async def merge_arrivals(queues, node_us):
+    # Rows from every Pico in the order the blocks arrive, for results with no ORDER BY
+    waiting = {asyncio.ensure_future(queue.get()): index for index, queue in enumerate(queues)}
+    while waiting:
+        done, _ = await asyncio.wait(waiting, return_when = asyncio.FIRST_COMPLETED)
+        for future in done:
+            index = waiting.pop(future)
+            kind, value = future.result()
+            if kind == "rows":
+                for row in value:
+                    yield row
+                waiting[asyncio.ensure_future(queues[index].get())] = index
+            elif kind == "end":
+                node_us[index] = value
+            else:
+                for pending in waiting:
+                    pending.cancel()
+                raise value
+# ============================================================
+
+# ============================================================
+# Usage: coordinator.py "SELECT time,potv WHERE potv>3000 ORDER BY time" [/dev/ttyACM0 /dev/ttyACM1 ...]
+# With no ports given every /dev/ttyACM* is used
+async def main(query, ports):
+    coordinator = Coordinator(ports)
+    await coordinator.open()
+    try:
+        start = time.monotonic()
+        names, rows = await coordinator.query(query)
+        took = time.monotonic() - start
+    finally:
+        coordinator.close()
+    print(", ".join(names))
+    for row in rows:
+        print(", ".join("NULL" if value is None else str(value) for value in row))
+    print("%d rows from %d Picos in %.1f ms (slowest Pico %u us)" % (len(rows), len(ports), took * 1000, max(coordinator.node_us, default = 0)))
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print("Usage: coordinator.py QUERY [PORT ...]")
+        sys.exit(1)
+    ports = sys.argv[2:] or sorted(glob.glob("/dev/ttyACM*"))
+    asyncio.run(main(sys.argv[1], ports))
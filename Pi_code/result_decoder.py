@@ -0,0 +1,118 @@
+#!/usr/bin/python
+
+# Decoder for the Pico's binary results - the frames sent back for DUMPB and SELECT ... FORMAT BINARY
+# Frame layout (little-endian): 'M' 'D' | type (1) | payload length (2) | payload | CRC-16/XMODEM of type, length and payload (2)
+
+import binascii, struct, sys
+
+SYNC = b"MD"
+# Column mask bits in the order the Pico sends them
+COLUMNS = [(8, "time", "<I", 4),
+           (4, "potv", "<H", 2),
+           (2, "butp", None, 0),
+           (1, "ledo", None, 0)]
+
+class FrameError(Exception):
+    pass
+
+def read_exact(stream, num_bytes):
+    data = b""
+    while len(data) < num_bytes:
+        chunk = stream.read(num_bytes - len(data))
+        if len(chunk) == 0:
+            raise FrameError("Stream ended in the middle of a frame")
+        data += chunk
+    return data
+
+def read_frame(stream):
+    # Skip anything before the sync bytes - text left over from earlier commands
+    last = b""
+    while True:
+        byte = read_exact(stream, 1)
+        if last + byte == SYNC:
+            break
+        last = byte
+    head = read_exact(stream, 3)
+    frame_type, length = struct.unpack("<cH", head)
+    payload = read_exact(stream, length)
+    (crc,) = struct.unpack("<H", read_exact(stream, 2))
+    if binascii.crc_hqx(head + payload, 0) != crc:
+        raise FrameError("CRC mismatch on %r frame" % frame_type)
+    return frame_type, payload
+
+def decode_column(bit, payload):
+    # Returns the values in one column frame
+    _, rows = struct.unpack_from("<BH", payload)
+    values = payload[3:]
+    for col_bit, _, fmt, width in COLUMNS:
+        if col_bit != bit:
+            continue
+        if fmt is not None:
+            return [struct.unpack_from(fmt, values, i * width)[0] for i in range(rows)]
+        return [(values[i >> 3] >> (i & 7)) & 1 for i in range(rows)]
+    raise FrameError("Unknown column bit %d" % bit)
+
+def read_header(stream):
+    # Reads the header frame of a result and returns (row count, column mask, column names)
+    frame_type, payload = read_frame(stream)
+    if frame_type != b"H":
+        raise FrameError("Expected a header frame, got %r" % frame_type)
+    num_rows, mask, _ = struct.unpack("<IBI", payload)
+    names = [name for bit, name, _, _ in COLUMNS if mask & bit]
+    return num_rows, mask, names
+
+def read_blocks(stream, num_rows, mask):
+    # Yields the rows of a result a block at a time as the column frames come in, after read_header
+    # The generator's return value is the microseconds the Pico spent sending
+    columns = {bit: [] for bit, _, _, _ in COLUMNS if mask & bit}
+    sent = 0
+    while True:
+        frame_type, payload = read_frame(stream)
+        if frame_type == b"E":
+            (elapsed,) = struct.unpack("<I", payload)
+            break
+        if frame_type != b"C":
+            raise FrameError("Unexpected %r frame" % frame_type)
+        bit = payload[0]
+        if bit not in columns:
+            raise FrameError("Column bit %d was not in the header" % bit)
+        columns[bit] += decode_column(bit, payload)
+        # A block is done once every column has caught up with it
+        ready = min(len(values) for values in columns.values())
+        if ready > sent:
+            ordered = [columns[bit][sent:ready] for bit, _, _, _ in COLUMNS if mask & bit]
+            yield list(zip(*ordered))
+            sent = ready
+    if sent != num_rows or any(len(values) != num_rows for values in columns.values()):
+        raise FrameError("Header promised %d rows, got %d" % (num_rows, sent))
+    return elapsed
+
+def read_result(stream):
+    # Reads one whole result and returns (column names, rows as tuples, microseconds the Pico spent sending)
+    num_rows, mask, names = read_header(stream)
+    rows = []
+    blocks = read_blocks(stream, num_rows, mask)
+    while True:
+        try:
+            rows += next(blocks)
+        except StopIteration as done:
+            return names, rows, done.value
+
+def query(ser, command):
+    # Send a DUMPB or SELECT ... FORMAT BINARY and decode the answer
+    ser.write((command + "\n").encode())
+    return read_result(ser)
+# ============================================================
+
+# ============================================================
+# Usage: result_decoder.py /dev/ttyACM0 "SELECT time,potv WHERE potv>3000 FORMAT BINARY"
+if __name__ == "__main__":
+    import serial
+    port = sys.argv[1] if len(sys.argv) > 1 else "/dev/ttyACM0"
+    command = sys.argv[2] if len(sys.argv) > 2 else "DUMPB"
+    ser = serial.Serial(port, 115200, timeout = 10)
+    names, rows, elapsed = query(ser, command)
+    print(", ".join(names))
+    for row in rows:
+        print(", ".join(str(value) for value in row))
+    print("%d rows, %u us on the Pico" % (len(rows), elapsed))
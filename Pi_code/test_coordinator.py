@@ -0,0 +1,193 @@
+#!/usr/bin/python
+
+# Coordinator test - runs the coordinator against fake Picos: host builds of the firmware (pico_mini_db_host) on ptys
+# Every fake Pico replays its own trace (PICO_HOST_TRACE): potv on a coarse grid, so rows tie across Picos, over a range that
+# is shifted for each one, so neither the lowest nor the highest value is on the first Pico
+# Every fake Pico is paused once it has some rows and its whole table is read straight off it, and then every query's answer
+# through the coordinator is checked against one worked out here from those tables
+#   merge      - an ORDER BY result is every Pico's sorted answer merged, ties going to the lower numbered Pico, and holds
+#                exactly the rows that pass the WHERE clause - DESC merges largest first, and LIMIT and OFFSET cut the
+#                merged rows, not each Pico's
+#   aggregates - COUNT, MIN, MAX, SUM and AVG, with and without GROUP BY, come out as if one Pico held every row
+#   histogram  - PERCENTILE and HISTOGRAM from the summed potv counts match the rows
+# Exits non-zero if any check fails, so it runs under ctest
+# Usage: test_coordinator.py PATH_TO_pico_mini_db_host [NUM_PICOS]
+
+import asyncio, os, pty, random, subprocess, sys, tempfile, time, tty
+from collections import Counter
+from coordinator import Coordinator, QueryError, send, parse_query, build_query, format_avg, percentile, COLUMN_ORDER
+from result_decoder import query as direct_query
+
+NUM_PICOS = 3
+START_GAP_S = 0.7   # Between starting fake Picos, so their tables hold different rows
+FILL_S = 3          # Collection time after the last one starts
+TRACE_SAMPLES = 4096
+TRACE_RANGE = 2500  # potv range of one Pico's trace
+TRACE_SHIFT = 500   # How far each Pico's range is moved from the one before
+TRACE_STEP = 16     # potv grid
+
+# Row results - (query, WHERE as a test on a (time, potv, butp, ledo) row)
+MERGE_QUERIES = [
+    ("SELECT * ORDER BY time", lambda r: True),
+    ("SELECT time,potv ORDER BY potv", lambda r: True),
+    ("SELECT potv,time WHERE potv>2000 ORDER BY potv,time", lambda r: r[1] > 2000),
+    ("SELECT time WHERE butp=1 ORDER BY ledo,potv", lambda r: r[2] == 1),
+    ("SELECT ledo,butp ORDER BY butp,ledo", lambda r: True),
+    ("SELECT * WHERE potv>5000 ORDER BY time", lambda r: False),
+    ("SELECT time,potv ORDER BY potv DESC", lambda r: True),
+    ("SELECT potv,time WHERE potv>1000 ORDER BY potv,time DESC LIMIT 25", lambda r: r[1] > 1000),
+    ("SELECT * ORDER BY time DESC LIMIT 10 OFFSET 15", lambda r: True),
+    ("SELECT ledo,potv ORDER BY butp,potv LIMIT 30 OFFSET 5", lambda r: True),
+    ("SELECT time ORDER BY potv LIMIT 5 OFFSET 1000", lambda r: True),
+]
+
+# Aggregates - (query, WHERE test, GROUP BY as a function of a row or None)
+AGG_QUERIES = [
+    ("SELECT COUNT(*),MIN(potv),MAX(potv),AVG(potv)", lambda r: True, None),
+    ("SELECT SUM(potv),COUNT(*),MIN(time) WHERE potv>2000", lambda r: r[1] > 2000, None),
+    ("SELECT COUNT(*),AVG(potv),MAX(time) GROUP BY butp", lambda r: True, lambda r: r[2]),
+    ("SELECT MIN(time),MAX(potv),COUNT(*) WHERE ledo=1 GROUP BY potv/512", lambda r: r[3] == 1, lambda r: r[1] // 512 * 512),
+    ("SELECT COUNT(*),MIN(potv),AVG(potv) WHERE potv>5000", lambda r: False, None),
+]
+
+failures = 0
+
+def check(cond, what):
+    global failures
+    if not cond:
+        failures += 1
+        print("FAIL: %s" % what)
+
+def write_trace(path, pico, count):
+    # Pico 0 gets the middle range, the lowest goes to the last one and the highest to the one before it
+    rand = random.Random(pico)
+    low = (pico + 1) % count * TRACE_SHIFT
+    with open(path, "w") as f:
+        for _ in range(TRACE_SAMPLES):
+            f.write("%d %d\n" % (rand.randrange(low, low + TRACE_RANGE, TRACE_STEP), rand.random() < 0.25))
+
+def start_picos(host, count, trace_dir):
+    # One host build per pty, talking on the pty's master side - the coordinator opens the other side like a /dev/ttyACM*
+    procs = []
+    ports = []
+    for i in range(count):
+        trace = os.path.join(trace_dir, "pico%d.txt" % i)
+        write_trace(trace, i, count)
+        master, slave = pty.openpty()
+        tty.setraw(master)
+        tty.setraw(slave)
+        procs.append(subprocess.Popen([host], stdin = master, stdout = master, env = dict(os.environ, PICO_HOST_TRACE = trace)))
+        ports.append(os.ttyname(slave))
+        time.sleep(START_GAP_S)
+    return procs, ports
+
+def aggregate_row(func, col, rows):
+    values = [row[COLUMN_ORDER.index(col)] for row in rows] if col != "*" else []
+    if func == "COUNT":
+        return len(rows)
+    if not rows:
+        return None
+    if func == "MIN":
+        return min(values)
+    if func == "MAX":
+        return max(values)
+    if func == "SUM":
+        return sum(values)
+    return format_avg(sum(values), len(values))
+# ============================================================
+
+# ============================================================
+async def test_merge(coordinator, tables):
+    for command, where in MERGE_QUERIES:
+        select, where_clause, _, order, desc, limit, offset = parse_query(command)
+        columns = COLUMN_ORDER if select == ["*"] else [c for c in COLUMN_ORDER if c in select]
+        fetched = [c for c in COLUMN_ORDER if c in columns or c in order]
+        # What the coordinator should give - each Pico's own sorted answer in Pico order, and a stable sort over them keeps
+        # every Pico's order within a key and puts ties from lower numbered Picos first, which is what the merge does
+        # (reverse = True keeps ties in the order they were in too), and then the page of that asked for
+        expect = []
+        for ser in coordinator.nodes:
+            _, rows, _ = direct_query(ser, build_query(fetched, where_clause, order = order, desc = desc, binary = True))
+            expect += rows
+        expect.sort(key = lambda row: tuple(row[fetched.index(c)] for c in order), reverse = desc)
+        expect = [tuple(row[fetched.index(c)] for c in columns) for row in expect]
+        expect = expect[offset:] if limit is None else expect[offset:offset + limit]
+        names, got = await coordinator.query(command)
+        check(names == columns, "%s names %s" % (command, names))
+        check(got == expect, "%s gave %d rows, %d expected in merge order" % (command, len(got), len(expect)))
+        # And the rows are the ones in the tables, checked without the Picos' help - all of them, or some for a LIMIT
+        rows = [tuple(row[COLUMN_ORDER.index(c)] for c in columns) for table in tables for row in table if where(row)]
+        if limit is None:
+            check(sorted(got) == sorted(rows), "%s rows are not the matching table rows" % command)
+        else:
+            check(not Counter(got) - Counter(rows), "%s rows are not all matching table rows" % command)
+
+async def test_aggregates(coordinator, tables):
+    rows = [row for table in tables for row in table]
+    for command, where, group in AGG_QUERIES:
+        select = parse_query(command)[0]
+        wanted = [(item.split("(")[0], item[item.index("(") + 1:-1]) for item in select]
+        matching = [row for row in rows if where(row)]
+        if group is None:
+            expect = [tuple(aggregate_row(func, col, matching) for func, col in wanted)]
+        else:
+            groups = {}
+            for row in matching:
+                groups.setdefault(group(row), []).append(row)
+            expect = [(key,) + tuple(aggregate_row(func, col, groups[key]) for func, col in wanted) for key in sorted(groups)]
+        _, got = await coordinator.query(command)
+        check(got == expect, "%s gave %s, expected %s" % (command, got, expect))
+
+async def test_histogram(coordinator, tables):
+    levels = {}
+    for table in tables:
+        for row in table:
+            levels[row[1]] = levels.get(row[1], 0) + 1
+    total = sum(levels.values())
+    _, got = await coordinator.query("SELECT PERCENTILE(potv),PERCENTILE(potv,0.99),COUNT(*),MAX(potv)")
+    expect = [(percentile(levels, total, 500000), percentile(levels, total, 990000), total, max(levels))]
+    check(got == expect, "PERCENTILE gave %s, expected %s" % (got, expect))
+    _, got = await coordinator.query("SELECT HISTOGRAM(potv,256)")
+    bins = {}
+    for level, rows_in in levels.items():
+        bins[level // 256 * 256] = bins.get(level // 256 * 256, 0) + rows_in
+    check(got == sorted(bins.items()), "HISTOGRAM gave %s, expected %s" % (got, sorted(bins.items())))
+    try:
+        await coordinator.query("SELECT PERCENTILE(potv,0.5),MIN(time)")
+        check(False, "PERCENTILE next to MIN(time) was not refused")
+    except QueryError:
+        pass
+
+async def run(ports):
+    coordinator = Coordinator(ports, timeout = 5)
+    await coordinator.open()
+    try:
+        for ser in coordinator.nodes:
+            send(ser, "PAUSE")
+        time.sleep(0.3)
+        tables = []
+        for ser in coordinator.nodes:
+            _, rows, _ = direct_query(ser, "SELECT * FORMAT BINARY")
+            tables.append(rows)
+        print("Tables of %s rows" % ", ".join(str(len(table)) for table in tables))
+        check(all(tables), "a fake Pico has no rows")
+        await test_merge(coordinator, tables)
+        await test_aggregates(coordinator, tables)
+        await test_histogram(coordinator, tables)
+    finally:
+        coordinator.close()
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print("Usage: test_coordinator.py PATH_TO_pico_mini_db_host [NUM_PICOS]")
+        sys.exit(1)
+    with tempfile.TemporaryDirectory() as trace_dir:
+        procs, ports = start_picos(sys.argv[1], int(sys.argv[2]) if len(sys.argv) > 2 else NUM_PICOS, trace_dir)
+        try:
+            time.sleep(FILL_S)
+            asyncio.run(run(ports))
+        finally:
+            for proc in procs:
+                proc.kill()
+    print("%d failures" % failures)
+    sys.exit(1 if failures else 0)
@@ -0,0 +1,60 @@
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "adc_dma.h"
+
+#define ADC_CLOCK_HZ 48000000   // The ADC takes one sample every (1 + clkdiv) cycles of this clock
+#define ADC_MIN_CLKDIV 96       // 500 ksps - a conversion takes 96 cycles
+
+static int dma_chan[2];
+static struct AdcStream *dma_stream;
+static uint32_t dma_button_pin;
+
+// One of the channels finished its block and has already chained to the other - point it back at the start of its block
+// for next time and tell the stream
+static void adc_dma_irq(){
+    for(int b = 0; b < 2; b++){
+        uint32_t mask = 1u << dma_chan[b];
+        if(dma_hw->ints0 & mask){
+            dma_hw->ints0 = mask;
+            dma_channel_set_write_addr(dma_chan[b], dma_stream->blocks[b], false);
+            adc_stream_block_done(dma_stream, gpio_get(dma_button_pin) == 0);
+        }
+    }
+}
+
+void adc_dma_start(struct AdcStream *stream, uint32_t sample_hz, uint32_t button_pin){
+    dma_stream = stream;
+    dma_button_pin = button_pin;
+
+    //Every conversion goes into the FIFO and raises DREQ, no error bit and no byte shift so samples stay 12-bit
+    adc_fifo_setup(true, true, 1, false, false);
+    float clkdiv = (float) ADC_CLOCK_HZ / sample_hz - 1.0f;
+    if(clkdiv < ADC_MIN_CLKDIV){
+        clkdiv = ADC_MIN_CLKDIV;
+    }
+    if(clkdiv > 65535.0f){
+        clkdiv = 65535.0f;
+    }
+    adc_set_clkdiv(clkdiv);
+
+    dma_chan[0] = dma_claim_unused_channel(true);
+    dma_chan[1] = dma_claim_unused_channel(true);
+    for(int b = 0; b < 2; b++){
+        dma_channel_config config = dma_channel_get_default_config(dma_chan[b]);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+        channel_config_set_read_increment(&config, false);
+        channel_config_set_write_increment(&config, true);
+        channel_config_set_dreq(&config, DREQ_ADC);
+        channel_config_set_chain_to(&config, dma_chan[1 - b]);
+        dma_channel_configure(dma_chan[b], &config, stream->blocks[b], &adc_hw->fifo, ADC_BLOCK_SAMPLES, false);
+        dma_channel_set_irq0_enabled(dma_chan[b], true);
+    }
+    irq_set_exclusive_handler(DMA_IRQ_0, adc_dma_irq);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    adc_stream_init(stream, sample_hz, time_us_32());
+    dma_channel_start(dma_chan[0]);
+    adc_run(true);
+}
@@ -0,0 +1,12 @@
+#ifndef ADC_DMA_H
+#define ADC_DMA_H
+
+#include <stdint.h>
+#include "adc_stream.h"
+
+// Start the ADC free-running at sample_hz on the currently selected input, with two chained DMA channels ping-ponging
+// its FIFO into the stream's staging blocks - the DMA interrupt lands on the core that calls this
+// The ADC clock divider limits sample_hz to between about 733 Hz and 500 kHz
+void adc_dma_start(struct AdcStream *stream, uint32_t sample_hz, uint32_t button_pin);
+
+#endif
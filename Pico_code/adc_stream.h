@@ -0,0 +1,94 @@
+#ifndef ADC_STREAM_H
+#define ADC_STREAM_H
+
+// Batched ingest for hardware-timed sampling
+// A source fills the two staging blocks in turn and calls adc_stream_block_done after each one - on the Pico that is the
+// ADC FIFO's DMA (adc_dma.c), anywhere else it can be anything that writes samples into the blocks
+// The table owner drains finished blocks in batches, and sample times come from the sample count and the rate rather
+// than from when anything got around to running, so they are evenly spaced however busy the consumer is
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "datapoint.h"
+
+#define ADC_BLOCK_SAMPLES 256   // Samples per staging block
+
+struct AdcStream {
+    uint16_t blocks[2][ADC_BLOCK_SAMPLES];  // Block n is written into blocks[n & 1]
+    bool button[2];                          // Button state when each block finished
+    _Atomic uint32_t filled;                 // Blocks the source has finished - only written by the source
+    uint32_t drained;                        // Blocks the consumer has taken or skipped - only touched by the consumer
+    uint32_t lost;                           // Blocks the source started overwriting before the consumer got to them
+    uint32_t sample_hz;
+    uint32_t next_time;                      // Timestamp of the first sample in block `drained`
+    uint32_t time_frac;                      // Leftover fraction of a microsecond, in units of 1 / sample_hz
+};
+
+static inline void adc_stream_init(struct AdcStream *stream, uint32_t sample_hz, uint32_t start_time){
+    atomic_store_explicit(&stream->filled, 0, memory_order_relaxed);
+    stream->drained = 0;
+    stream->lost = 0;
+    stream->sample_hz = sample_hz;
+    stream->next_time = start_time;
+    stream->time_frac = 0;
+}
+
+// Source side - blocks[n & 1] is full and the source has moved on to the other block
+static inline void adc_stream_block_done(struct AdcStream *stream, bool button){
+    uint32_t n = atomic_load_explicit(&stream->filled, memory_order_relaxed);
+    stream->button[n & 1] = button;
+    atomic_store_explicit(&stream->filled, n + 1, memory_order_release);
+}
+
+// Timestamp of the current sample, then step to the next one - 1000000 / sample_hz with the remainder carried over
+static inline uint32_t adc_stream_tick(struct AdcStream *stream){
+    uint32_t now = stream->next_time;
+    stream->next_time += 1000000 / stream->sample_hz;
+    stream->time_frac += 1000000 % stream->sample_hz;
+    if(stream->time_frac >= stream->sample_hz){
+        stream->time_frac -= stream->sample_hz;
+        stream->next_time ++;
+    }
+    return now;
+}
+
+// Consumer side - hand every finished block to sink a sample at a time, returns how many samples went to sink
+// Each block is copied out first and only used if the source had not started writing over it by the end of the copy
+static inline int adc_stream_drain(struct AdcStream *stream, void (*sink)(struct DataPoint)){
+    int delivered = 0;
+    uint16_t copy[ADC_BLOCK_SAMPLES];
+    while(true){
+        uint32_t filled = atomic_load_explicit(&stream->filled, memory_order_acquire);
+        if(filled == stream->drained){
+            return delivered;
+        }
+        int b = stream->drained & 1;
+        bool button = stream->button[b];
+        for(int i = 0; i < ADC_BLOCK_SAMPLES; i++){
+            copy[i] = stream->blocks[b][i];
+        }
+        filled = atomic_load_explicit(&stream->filled, memory_order_acquire);
+        if(filled - stream->drained > 1){
+            //The source finished the next block too and is now refilling this one - skip it but keep the clock right
+            stream->lost ++;
+            for(int i = 0; i < ADC_BLOCK_SAMPLES; i++){
+                adc_stream_tick(stream);
+            }
+        }
+        else{
+            for(int i = 0; i < ADC_BLOCK_SAMPLES; i++){
+                struct DataPoint point;
+                point.ms_time = adc_stream_tick(stream);
+                point.potentiometer_value = copy[i];
+                point.button_pressed = button;
+                point.led_on = true;
+                sink(point);
+            }
+            delivered += ADC_BLOCK_SAMPLES;
+        }
+        stream->drained ++;
+    }
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef CRC16_H
+#define CRC16_H
+
+// CRC-16/XMODEM - polynomial 0x1021, starting from 0, the same as Python's binascii.crc_hqx(data, 0)
+// Used for the binary result frames and for the flash log's page headers
+
+#include <stdint.h>
+
+static inline uint16_t crc16_update(uint16_t crc, const uint8_t *buf, int len){
+    for(int i = 0; i < len; i++){
+        crc ^= (uint16_t) buf[i] << 8;
+        for(int b = 0; b < 8; b++){
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static inline uint16_t crc16(const uint8_t *buf, int len){
+    return crc16_update(0, buf, len);
+}
+
+#endif
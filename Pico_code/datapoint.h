@@ -0,0 +1,77 @@
+#ifndef DATAPOINT_H
+#define DATAPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The table's schema, declared once - main.c generates the column storage, row gather and scatter, the lexer's column names,
+// the WHERE kernels, sort key widths, text and binary output and core1's sampling from this list, so a new sensor is one line
+// X(ID, name, storage, key_bits, field, sample, dump_label)
+//   ID          COL_ID - columns are numbered in the order listed, which is also their order in results
+//   name        What queries call it - four letters
+//   storage     U32, U16 or BIT (packed 32 rows to a word) - picks the array type, the kernels and the binary frame layout
+//   key_bits    Width in a packed ORDER BY key - the most a value can take up
+//   field       Its member of struct DataPoint
+//   sample      How core1 reads it
+//   dump_label  What goes in front of it in a DUMP line
+// Zone maps and RowSummary are generated from it as well; time and potv also have indexes, flash records and compressed
+// blocks, which are written for those two columns by hand
+#define TABLE_COLUMNS(X) \
+    X(TIME, time, U32, 32, ms_time, time_us_32(), "\tTimestamp: ") \
+    X(POTV, potv, U16, 12, potentiometer_value, adc_read(), "\tPotentiometer ") \
+    X(BUTP, butp, BIT, 1, button_pressed, gpio_get(BUTTON_PIN) == 0, "\tButton: ") \
+    X(LEDO, ledo, BIT, 1, led_on, true, "\tLED: ")
+
+// C type a storage kind holds one value in
+#define COLUMN_CTYPE_U32 uint32_t
+#define COLUMN_CTYPE_U16 uint16_t
+#define COLUMN_CTYPE_BIT bool
+
+// One row - only used to pass single rows around, the table itself is columnar
+#define DATAPOINT_FIELD(ID, name, storage, key_bits, field, sample, dump_label) COLUMN_CTYPE_##storage field;
+struct DataPoint {
+    TABLE_COLUMNS(DATAPOINT_FIELD)
+};
+
+// Min and max of a column - the zone maps and RowSummary keep these for every U32 and U16 column
+#define RANGE_FIELDS_U32(name) uint32_t name##_min; uint32_t name##_max;
+#define RANGE_FIELDS_U16(name) uint16_t name##_min; uint16_t name##_max;
+#define RANGE_FIELDS_BIT(name)
+#define RANGE_FIELDS(ID, name, storage, key_bits, field, sample, dump_label) RANGE_FIELDS_##storage(name)
+
+// RowSummary.seen - two bits for every BIT column, set when a 0 or a 1 shows up in it
+#define SEEN_SLOT_U32(ID)
+#define SEEN_SLOT_U16(ID)
+#define SEEN_SLOT_BIT(ID) SEEN_SLOT_##ID,
+#define SEEN_SLOT(ID, name, storage, key_bits, field, sample, dump_label) SEEN_SLOT_##storage(ID)
+enum {
+    TABLE_COLUMNS(SEEN_SLOT)
+    NUM_SEEN_SLOTS
+};
+_Static_assert(NUM_SEEN_SLOTS <= 4, "RowSummary.seen has room for four BIT columns");
+#define SEEN_ZERO(slot) (1 << (2 * (slot)))
+#define SEEN_ONE(slot) (2 << (2 * (slot)))
+
+// Ranges of a run of rows stored together (a flash page, a compressed block) - enough to tell a scan it can skip them
+// Stored in flash page headers, so a column added to the schema changes the log format
+struct RowSummary {
+    TABLE_COLUMNS(RANGE_FIELDS)
+    uint8_t seen;           // SEEN_ZERO and SEEN_ONE of every BIT column
+};
+
+// Widen the ranges to take in point - first is true for the first row of the run
+#define SUMMARY_ADD_RANGE(name, field) \
+    if(first || (point.field < summary->name##_min)) summary->name##_min = point.field; \
+    if(first || (point.field > summary->name##_max)) summary->name##_max = point.field;
+#define SUMMARY_ADD_U32(ID, name, field) SUMMARY_ADD_RANGE(name, field)
+#define SUMMARY_ADD_U16(ID, name, field) SUMMARY_ADD_RANGE(name, field)
+#define SUMMARY_ADD_BIT(ID, name, field) summary->seen |= point.field ? SEEN_ONE(SEEN_SLOT_##ID) : SEEN_ZERO(SEEN_SLOT_##ID);
+#define SUMMARY_ADD(ID, name, storage, key_bits, field, sample, dump_label) SUMMARY_ADD_##storage(ID, name, field)
+static inline void row_summary_add(struct RowSummary *summary, struct DataPoint point, bool first){
+    if(first){
+        summary->seen = 0;
+    }
+    TABLE_COLUMNS(SUMMARY_ADD)
+}
+
+#endif
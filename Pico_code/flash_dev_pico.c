@@ -0,0 +1,45 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "flash_dev_pico.h"
+
+#define FLASH_SAFE_TIMEOUT_MS 100   // How long to wait for the other core to park
+
+struct FlashOp {
+    uint32_t offset;
+    const void *page;
+};
+
+static void flash_dev_read(void *ctx, uint32_t offset, void *buf, uint32_t len){
+    memcpy(buf, (const void*)(XIP_BASE + FLASH_LOG_OFFSET + offset), len);
+}
+
+// These two run with interrupts off and the other core parked - flash_range_* live in RAM
+static void do_program(void *param){
+    struct FlashOp *op = param;
+    flash_range_program(FLASH_LOG_OFFSET + op->offset, op->page, FLASH_LOG_PAGE);
+}
+
+static void do_erase(void *param){
+    struct FlashOp *op = param;
+    flash_range_erase(FLASH_LOG_OFFSET + op->offset, FLASH_LOG_SECTOR);
+}
+
+static bool flash_dev_program(void *ctx, uint32_t offset, const void *page){
+    struct FlashOp op = {offset, page};
+    return flash_safe_execute(do_program, &op, FLASH_SAFE_TIMEOUT_MS) == PICO_OK;
+}
+
+static bool flash_dev_erase(void *ctx, uint32_t offset){
+    struct FlashOp op = {offset, NULL};
+    return flash_safe_execute(do_erase, &op, FLASH_SAFE_TIMEOUT_MS) == PICO_OK;
+}
+
+void flash_dev_pico_init(struct FlashDev *dev){
+    dev->ctx = NULL;
+    dev->size = PICO_FLASH_SIZE_BYTES - FLASH_LOG_OFFSET;
+    dev->read = flash_dev_read;
+    dev->program = flash_dev_program;
+    dev->erase = flash_dev_erase;
+}
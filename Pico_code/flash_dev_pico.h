@@ -0,0 +1,12 @@
+#ifndef FLASH_DEV_PICO_H
+#define FLASH_DEV_PICO_H
+
+#include "flash_log.h"
+
+#define FLASH_LOG_OFFSET (1024 * 1024)  // The log takes the flash from here to the end - the program has to fit in front of it
+
+// FlashDev for the Pico's own flash - reads go through XIP, programs and erases go through flash_safe_execute, which
+// parks the other core for as long as flash is unreadable. The other core has to have called flash_safe_execute_core_init
+void flash_dev_pico_init(struct FlashDev *dev);
+
+#endif
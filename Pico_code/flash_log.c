@@ -0,0 +1,149 @@
+#include <stddef.h>
+#include <string.h>
+#include "crc16.h"
+#include "flash_log.h"
+
+#define CRC_SPAN offsetof(struct FlashPageHeader, crc)
+
+static uint16_t page_crc(const struct FlashLogPage *page){
+    uint16_t crc = crc16_update(0, (const uint8_t*) &page->header, CRC_SPAN);
+    return crc16_update(crc, page->rows, sizeof(page->rows));
+}
+
+// Page n of the scan order as a page number in the region
+static uint32_t log_page(const struct FlashLog *log, uint32_t n){
+    return (log->head + log->pages - log->span + n) % log->pages;
+}
+
+static bool header_ok(const struct FlashPageHeader *header){
+    return (header->magic == FLASH_LOG_MAGIC) && (header->count > 0) && (header->count <= FLASH_PAGE_ROWS);
+}
+
+static void stage_reset(struct FlashLog *log){
+    memset(&log->stage, 0xFF, sizeof(log->stage));
+    log->stage.header.count = 0;
+}
+
+// Read page p straight from the region and check all of it
+static bool page_valid(const struct FlashLog *log, uint32_t p, struct FlashLogPage *page){
+    log->dev->read(log->dev->ctx, p * FLASH_LOG_PAGE, page, FLASH_LOG_PAGE);
+    return header_ok(&page->header) && (page->header.crc == page_crc(page));
+}
+
+void flash_log_open(struct FlashLog *log, const struct FlashDev *dev){
+    log->dev = dev;
+    log->pages = dev->size / FLASH_LOG_PAGE;
+    log->head = 0;
+    log->span = 0;
+    log->seq = 0;
+    log->lost = 0;
+    stage_reset(log);
+
+    //Newest page - the valid one with the largest sequence number
+    struct FlashLogPage page;
+    bool found = false;
+    uint32_t newest = 0;
+    for(uint32_t p = 0; p < log->pages; p++){
+        if(page_valid(log, p, &page) && (!found || ((int32_t)(page.header.seq - log->seq) > 0))){
+            found = true;
+            newest = p;
+            log->seq = page.header.seq;
+        }
+    }
+    if(!found){
+        return;
+    }
+    //Count back over the pages written before it, stopping at the first gap or older lap
+    log->span = 1;
+    while(log->span < log->pages - FLASH_LOG_PAGES_PER_SECTOR){
+        uint32_t p = (newest + log->pages - log->span) % log->pages;
+        if(!page_valid(log, p, &page) || (page.header.seq != log->seq - log->span)){
+            break;
+        }
+        log->span ++;
+    }
+    log->head = (newest + 1) % log->pages;
+    log->seq ++;
+    //A reset in the middle of programming can leave the head page half written - it cannot be programmed again until its
+    //sector is erased, so move on to the next sector and let the scan skip whatever is left in this one
+    if(log->head % FLASH_LOG_PAGES_PER_SECTOR != 0){
+        log->dev->read(log->dev->ctx, log->head * FLASH_LOG_PAGE, &page, FLASH_LOG_PAGE);
+        const uint8_t *bytes = (const uint8_t*) &page;
+        for(int i = 0; i < FLASH_LOG_PAGE; i++){
+            if(bytes[i] != 0xFF){
+                uint32_t skip = FLASH_LOG_PAGES_PER_SECTOR - log->head % FLASH_LOG_PAGES_PER_SECTOR;
+                log->head = (log->head + skip) % log->pages;
+                log->span += skip;
+                break;
+            }
+        }
+    }
+}
+
+void flash_log_append(struct FlashLog *log, struct DataPoint point){
+    struct FlashPageHeader *header = &log->stage.header;
+    uint16_t potv = point.potentiometer_value & 0xFFF;
+    point.potentiometer_value = potv;
+    row_summary_add(&header->summary, point, header->count == 0);
+
+    uint16_t packed = potv | (point.button_pressed << 12) | (point.led_on << 13);
+    uint8_t *p = log->stage.rows + header->count * FLASH_ROW_BYTES;
+    p[0] = point.ms_time;
+    p[1] = point.ms_time >> 8;
+    p[2] = point.ms_time >> 16;
+    p[3] = point.ms_time >> 24;
+    p[4] = packed;
+    p[5] = packed >> 8;
+    header->count ++;
+    if(header->count == FLASH_PAGE_ROWS){
+        flash_log_flush(log);
+    }
+}
+
+void flash_log_flush(struct FlashLog *log){
+    struct FlashPageHeader *header = &log->stage.header;
+    if(header->count == 0){
+        return;
+    }
+    header->magic = FLASH_LOG_MAGIC;
+    header->seq = log->seq;
+    header->pad = 0xFFFF;
+    header->crc = page_crc(&log->stage);
+    const struct FlashDev *dev = log->dev;
+    bool ok = true;
+    //First page of a sector - the sector still holds the oldest pages of the last lap, and they go now
+    if(log->head % FLASH_LOG_PAGES_PER_SECTOR == 0){
+        ok = dev->erase(dev->ctx, log->head * FLASH_LOG_PAGE);
+        if(log->span > log->pages - FLASH_LOG_PAGES_PER_SECTOR){
+            log->span = log->pages - FLASH_LOG_PAGES_PER_SECTOR;
+        }
+    }
+    if(ok){
+        ok = dev->program(dev->ctx, log->head * FLASH_LOG_PAGE, &log->stage);
+    }
+    if(!ok){
+        log->lost ++;
+    }
+    //The page is used up either way - a failed one gets skipped by its CRC
+    log->head = (log->head + 1) % log->pages;
+    log->span ++;
+    log->seq ++;
+    stage_reset(log);
+}
+
+bool flash_log_header(const struct FlashLog *log, uint32_t n, struct FlashPageHeader *header){
+    if(n >= log->span){
+        *header = log->stage.header;
+        return log->stage.header.count > 0;
+    }
+    log->dev->read(log->dev->ctx, log_page(log, n) * FLASH_LOG_PAGE, header, sizeof(*header));
+    return header_ok(header);
+}
+
+bool flash_log_read(const struct FlashLog *log, uint32_t n, struct FlashLogPage *page){
+    if(n >= log->span){
+        *page = log->stage;
+        return log->stage.header.count > 0;
+    }
+    return page_valid(log, log_page(log, n), page);
+}
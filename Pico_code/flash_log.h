@@ -0,0 +1,91 @@
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+// Log-structured history in flash - every sample the table takes is also appended here, so history goes back far further
+// than the rows SRAM can hold and survives a reset
+// Samples are staged in RAM a page at a time and the page is programmed once it is full. Pages go round the region in order,
+// and a sector is erased as the log comes back round to it, so every sector is erased once per lap and wears the same
+// Each page starts with a header holding the min and max time and potv (and which button/LED values appear) of its rows,
+// which lets a scan skip every page a WHERE clause rules out by reading 28 bytes of it
+// Nothing in here knows about the Pico - flash is reached through a FlashDev, so the same code runs against a file on a PC
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "datapoint.h"
+
+#define FLASH_LOG_PAGE 256          // Program unit - one log page
+#define FLASH_LOG_SECTOR 4096       // Erase unit
+#define FLASH_LOG_PAGES_PER_SECTOR (FLASH_LOG_SECTOR / FLASH_LOG_PAGE)
+#define FLASH_LOG_MAGIC 0x4C4D      // "ML" - erased flash reads 0xFFFF
+#define FLASH_ROW_BYTES 6           // u32 time, u16 potv in the low 12 bits with butp in bit 12 and ledo in bit 13
+#define FLASH_PAGE_ROWS ((FLASH_LOG_PAGE - 28) / FLASH_ROW_BYTES)
+
+struct FlashPageHeader {
+    uint16_t magic;         // FLASH_LOG_MAGIC
+    uint16_t count;         // Rows in the page, 1 to FLASH_PAGE_ROWS
+    uint32_t seq;           // Pages written before this one - the newest page has the largest
+    struct RowSummary summary;
+    uint16_t crc;           // CRC-16 of the header before this field and every row slot after it
+    uint16_t pad;
+};
+_Static_assert(sizeof(struct FlashPageHeader) == 28, "FLASH_PAGE_ROWS assumes a 28 byte header");
+
+struct FlashLogPage {
+    struct FlashPageHeader header;
+    uint8_t rows[FLASH_LOG_PAGE - sizeof(struct FlashPageHeader)];
+};
+_Static_assert(sizeof(struct FlashLogPage) == FLASH_LOG_PAGE, "A log page is one program unit");
+
+// The flash region the log owns - offsets are from the start of the region, size is a whole number of sectors (at least two)
+// program and erase return false if the write could not be done, and the staged page is then dropped
+struct FlashDev {
+    void *ctx;
+    uint32_t size;
+    void (*read)(void *ctx, uint32_t offset, void *buf, uint32_t len);
+    bool (*program)(void *ctx, uint32_t offset, const void *page);  // One FLASH_LOG_PAGE at a page boundary, already erased
+    bool (*erase)(void *ctx, uint32_t offset);                      // One FLASH_LOG_SECTOR at a sector boundary
+};
+
+struct FlashLog {
+    const struct FlashDev *dev;
+    uint32_t pages;             // Pages in the region
+    uint32_t head;              // Page the staged rows get programmed to
+    uint32_t span;              // Pages before head that can hold rows - the oldest is span pages back
+    uint32_t seq;               // Sequence number the staged page gets
+    uint32_t lost;              // Pages dropped because programming failed
+    struct FlashLogPage stage;  // Rows not in flash yet
+};
+
+// Pick up where the log in flash left off - finds the newest page and counts back over the ones before it
+// Reads every page once, so it is slow on a big region but only runs at boot
+void flash_log_open(struct FlashLog *log, const struct FlashDev *dev);
+
+// Add a row - programs the staged page when it fills up, erasing the next sector first when the page starts one
+void flash_log_append(struct FlashLog *log, struct DataPoint point);
+
+// Program the staged page now, even if it is not full
+void flash_log_flush(struct FlashLog *log);
+
+// Pages a scan visits, oldest first - page n == span is the staged page in RAM
+static inline uint32_t flash_log_pages(const struct FlashLog *log){
+    return log->span + 1;
+}
+
+// Header of page n - false if there are no rows there (never written, torn by a reset, or an empty stage)
+bool flash_log_header(const struct FlashLog *log, uint32_t n, struct FlashPageHeader *header);
+
+// Whole page n - false if there are no rows there or the CRC does not match
+bool flash_log_read(const struct FlashLog *log, uint32_t n, struct FlashLogPage *page);
+
+static inline struct DataPoint flash_page_row(const struct FlashLogPage *page, int i){
+    const uint8_t *p = page->rows + i * FLASH_ROW_BYTES;
+    uint16_t packed = p[4] | (p[5] << 8);
+    struct DataPoint point;
+    point.ms_time = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+    point.potentiometer_value = packed & 0xFFF;
+    point.button_pressed = (packed >> 12) & 1;
+    point.led_on = (packed >> 13) & 1;
+    return point;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+// Count of stored rows at every potentiometer level, behind PERCENTILE and HISTOGRAM - kept up to date as rows are stored
+// and evicted, so neither has to look at a row
+// A 12-bit reading only has 4096 values, so one count per value takes 8 KB - more than a KLL sketch or t-digest would, but
+// every answer is exact, evicted rows can be taken back out, which those cannot do, and histograms from several Picos merge
+// by adding them up
+// Levels are also summed into HIST_BINS coarse bins so a rank is found in at most HIST_BINS + HIST_BIN_LEVELS steps
+// Nothing in here knows about the Pico
+
+#include <stdint.h>
+
+#define HIST_LEVELS 4096                            // Values a reading can take
+#define HIST_BINS 64                                // Bins HISTOGRAM gives by default
+#define HIST_BIN_LEVELS (HIST_LEVELS / HIST_BINS)   // Levels a bin covers
+#define HIST_ONE 1000000                            // PERCENTILE fractions are kept in millionths
+
+struct Histogram {
+    uint32_t count;                 // Rows counted
+    uint16_t bins[HIST_BINS];       // Rows in each run of HIST_BIN_LEVELS levels
+    uint16_t levels[HIST_LEVELS];   // Rows at each level - 16 bits is plenty while row ids are
+};
+
+static inline void hist_init(struct Histogram *hist){
+    hist->count = 0;
+    for(int b = 0; b < HIST_BINS; b++){
+        hist->bins[b] = 0;
+    }
+    for(int v = 0; v < HIST_LEVELS; v++){
+        hist->levels[v] = 0;
+    }
+}
+
+static inline void hist_add(struct Histogram *hist, uint16_t v){
+    hist->count ++;
+    hist->bins[v / HIST_BIN_LEVELS] ++;
+    hist->levels[v] ++;
+}
+
+static inline void hist_remove(struct Histogram *hist, uint16_t v){
+    hist->count --;
+    hist->bins[v / HIST_BIN_LEVELS] --;
+    hist->levels[v] --;
+}
+
+// Rows at levels [v, v + width) - whole bins are taken from bins when the range lines up with them
+static inline uint32_t hist_range(const struct Histogram *hist, int v, int width){
+    int end = (v + width < HIST_LEVELS) ? v + width : HIST_LEVELS;
+    uint32_t rows = 0;
+    while(v < end){
+        if((v % HIST_BIN_LEVELS == 0) && (v + HIST_BIN_LEVELS <= end)){
+            rows += hist->bins[v / HIST_BIN_LEVELS];
+            v += HIST_BIN_LEVELS;
+        }
+        else{
+            rows += hist->levels[v++];
+        }
+    }
+    return rows;
+}
+
+// Nearest-rank percentile - the lowest level with at least fraction (in millionths) of the rows at or below it
+// Only meaningful when count > 0
+static inline uint16_t hist_percentile(const struct Histogram *hist, uint32_t fraction){
+    uint32_t rank = ((uint64_t) fraction * hist->count + HIST_ONE - 1) / HIST_ONE;
+    if(rank == 0){
+        rank = 1;
+    }
+    int b = 0;
+    while((b < HIST_BINS - 1) && (hist->bins[b] < rank)){
+        rank -= hist->bins[b++];
+    }
+    int v = b * HIST_BIN_LEVELS;
+    while((v < HIST_LEVELS - 1) && (hist->levels[v] < rank)){
+        rank -= hist->levels[v++];
+    }
+    return v;
+}
+
+#endif
@@ -0,0 +1,173 @@
+//Benchmark harness - the database core from main.c on the host HAL, fed a trace straight into table_insert and then asked
+//every query in a query file
+//Reports, tab separated so runs can be diffed and plotted:
+//  ingest  - table_insert while the table is filling
+//  evict   - table_insert once it is full, each one picking the next row to overwrite
+//  query   - per query, the plan (compile and fill sel) and the whole query with every row formatted, min and median of runs
+//Usage: bench [-t walk|sine|steps|noise|FILE] [-n samples] [-r runs] [-s seed] [queries]
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define main pico_main
+#include "../main.c"
+#undef main
+
+#include "host_hal.h"
+
+#define BENCH_MAX_QUERIES 64
+#define BENCH_MAX_RUNS 64
+
+//Synthetic traces - sized to the run, always the same for the same seed
+static uint16_t *trace_potv;
+static bool *trace_button;
+
+static void trace_make(const char *kind, int count){
+    trace_potv = malloc(count * sizeof(*trace_potv));
+    trace_button = malloc(count * sizeof(*trace_button));
+    int walk = 2048;
+    for(int i = 0; i < count; i++){
+        int v;
+        if(strcmp(kind, "sine") == 0){
+            v = 2048 + (int)(1800 * sin(i * 0.01)) + rand() % 17 - 8;
+        }
+        else if(strcmp(kind, "steps") == 0){
+            v = ((i / 500) * 733) % 4096;
+        }
+        else if(strcmp(kind, "noise") == 0){
+            v = rand() % 4096;
+        }
+        else{
+            walk += rand() % 65 - 32;
+            walk = walk < 0 ? 0 : (walk > 4095 ? 4095 : walk);
+            v = walk;
+        }
+        trace_potv[i] = v < 0 ? 0 : (v > 4095 ? 4095 : v);
+        trace_button[i] = (rand() % 5) == 0;
+    }
+    host_trace_set(trace_potv, trace_button, count);
+}
+
+static int cmp_u32(const void *a, const void *b){
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t median(uint32_t *v, int n){
+    qsort(v, n, sizeof(*v), cmp_u32);
+    return v[n / 2];
+}
+
+int main(int argc, char **argv){
+    const char *trace = "walk";
+    const char *queries = "practice_query.txt";
+    int samples = 4 * ARRAY_SIZE;
+    int runs = 5;
+    unsigned seed = 1;
+    int opt;
+    while((opt = getopt(argc, argv, "t:n:r:s:")) != -1){
+        if(opt == 't') trace = optarg;
+        else if(opt == 'n') samples = atoi(optarg);
+        else if(opt == 'r') runs = atoi(optarg);
+        else if(opt == 's') seed = atoi(optarg);
+        else{
+            fprintf(stderr, "Usage: %s [-t walk|sine|steps|noise|FILE] [-n samples] [-r runs] [-s seed] [queries]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(optind < argc){
+        queries = argv[optind];
+    }
+    runs = runs < 1 ? 1 : (runs > BENCH_MAX_RUNS ? BENCH_MAX_RUNS : runs);
+    srand(seed);
+    if(strchr(trace, '/') || strchr(trace, '.')){
+        if(host_trace_load(trace) <= 0){
+            fprintf(stderr, "Could not read a trace from %s\n", trace);
+            return 1;
+        }
+    }
+    else{
+        trace_make(trace, samples);
+    }
+
+    //Results go to a copy of stdout, everything the database prints goes to /dev/null so formatting is timed but not shown
+    FILE *report = fdopen(dup(1), "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    fflush(stdout);
+    dup2(null_fd, 1);
+
+    db_init();
+    fprintf(report, "array_size\t%d\ntrace\t%s\nsamples\t%d\n", ARRAY_SIZE, trace, samples);
+
+    //Ingest - one sample every MS_BT_LOOP, in µs like the sampler stamps them
+    uint64_t fill_us = 0;
+    uint64_t evict_us = 0;
+    int fills = 0;
+    uint32_t t = 0;
+    for(int i = 0; i < samples; i++){
+        struct DataPoint point;
+        point.potentiometer_value = adc_read();
+        point.button_pressed = gpio_get(BUTTON_PIN) == 0;
+        point.led_on = true;
+        t += MS_BT_LOOP * 1000 + rand() % 64;
+        point.ms_time = t;
+        bool full = num_samples >= ARRAY_SIZE;
+        uint64_t before = time_us_64();
+        table_insert(point);
+        uint64_t took = time_us_64() - before;
+        if(full){
+            evict_us += took;
+        }
+        else{
+            fill_us += took;
+            fills ++;
+        }
+    }
+    fprintf(report, "ingest_ns_per_row\t%.1f\n", fills ? fill_us * 1000.0 / fills : 0.0);
+    fprintf(report, "evict_ns_per_row\t%.1f\n", samples > fills ? evict_us * 1000.0 / (samples - fills) : 0.0);
+
+    //Queries - every SELECT line of the file, the "Result:" lines under them are left alone
+    FILE *f = fopen(queries, "r");
+    if(f == NULL){
+        fprintf(stderr, "Could not read queries from %s\n", queries);
+        return 1;
+    }
+    fprintf(report, "query\trows\tplan_us_min\tplan_us_med\ttotal_us_min\ttotal_us_med\n");
+    char line[RX_LINE_MAX + 2];
+    int num_queries = 0;
+    while(fgets(line, sizeof(line), f) && (num_queries < BENCH_MAX_QUERIES)){
+        int len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if(strncmp(line, "SELECT", 6) != 0){
+            continue;
+        }
+        num_queries ++;
+        uint32_t plan_us[BENCH_MAX_RUNS];
+        uint32_t total_us[BENCH_MAX_RUNS];
+        int rows = 0;
+        for(int r = 0; r < runs; r++){
+            struct QueryPlan plan;
+            uint32_t start = time_us_32();
+            compile_query(line, len, &plan);
+            run_plan(&plan, start);
+            plan_us[r] = time_us_32() - start;
+            rows = cursor.count;
+            while(cursor.kind != CURSOR_IDLE){
+                cursor_step(time_us_32() + 1000000);
+            }
+            total_us[r] = time_us_32() - start;
+        }
+        //median sorts, so the minimum is the first one after it
+        uint32_t plan_med = median(plan_us, runs);
+        uint32_t total_med = median(total_us, runs);
+        fprintf(report, "%s\t%d\t%u\t%u\t%u\t%u\n", line, rows, plan_us[0], plan_med, total_us[0], total_med);
+    }
+    fclose(f);
+    fclose(report);
+    return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef HOST_HARDWARE_ADC_H
+#define HOST_HARDWARE_ADC_H
+
+#include <stdint.h>
+
+// adc_read replays the loaded trace (host_hal.h), or a random walk when there is none
+
+void adc_init(void);
+void adc_gpio_init(unsigned pin);
+void adc_select_input(unsigned input);
+uint16_t adc_read(void);
+
+#endif
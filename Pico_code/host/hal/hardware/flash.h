@@ -0,0 +1,18 @@
+#ifndef HOST_HARDWARE_FLASH_H
+#define HOST_HARDWARE_FLASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Flash is a 2 MB array that starts erased, or a file when PICO_HOST_FLASH names one so the log outlives a run
+// Programming can only clear bits, the same as the real thing
+
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#define XIP_BASE ((uintptr_t) host_flash)
+
+extern uint8_t *host_flash;
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+void flash_range_erase(uint32_t flash_offs, size_t count);
+
+#endif
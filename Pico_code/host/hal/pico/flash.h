@@ -0,0 +1,11 @@
+#ifndef HOST_PICO_FLASH_H
+#define HOST_PICO_FLASH_H
+
+#include <stdint.h>
+
+// Nothing to park on the host - func just runs
+
+void flash_safe_execute_core_init(void);
+int flash_safe_execute(void (*func)(void*), void *param, uint32_t enter_exit_timeout_ms);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef HOST_PICO_MULTICORE_H
+#define HOST_PICO_MULTICORE_H
+
+// Core1 is a thread
+
+void multicore_launch_core1(void (*entry)(void));
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef HOST_PICO_STDIO_USB_H
+#define HOST_PICO_STDIO_USB_H
+
+// Binary frames go straight to stdout, in order with everything printf has sent
+
+typedef struct {
+    void (*out_chars)(const char *buf, int len);
+} stdio_driver_t;
+
+extern stdio_driver_t stdio_usb;
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+// Host stand-in for the parts of the Pico SDK the database uses - see host_hal.c
+// GPIO does nothing except the button, which comes from the replayed trace; time is the host's monotonic clock
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PICO_OK 0
+#define PICO_ERROR_TIMEOUT (-1)
+#define GPIO_IN 0
+#define GPIO_OUT 1
+
+void stdio_init_all(void);
+void stdio_set_chars_available_callback(void (*fn)(void*), void *param);
+int getchar_timeout_us(uint32_t timeout_us);
+
+void gpio_init(unsigned pin);
+void gpio_set_dir(unsigned pin, bool out);
+void gpio_pull_up(unsigned pin);
+void gpio_put(unsigned pin, bool value);
+bool gpio_get(unsigned pin);
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void __wfi(void);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef HOST_TUSB_H
+#define HOST_TUSB_H
+
+#include <stdint.h>
+
+// stdout never runs out of room the way the CDC FIFO does - this is just how much the TX buffer hands over at a time
+
+uint32_t tud_cdc_write_available(void);
+
+#endif
@@ -0,0 +1,293 @@
+#define _GNU_SOURCE     // clock_gettime, nanosleep, poll and mmap under -std=c11
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "pico/rand.h"
+#include "pico/stdio_usb.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
+#include "hardware/adc.h"
+#include "hardware/flash.h"
+#include "tusb.h"
+#include "adc_dma.h"
+#include "host_hal.h"
+
+#define HOST_EOF_LINGER_MS 500  // After stdin closes, time left for the last results to go out before the process exits
+
+//------------------------------------------------------------------------------------------------------------------------
+//Time
+static uint64_t clock_start;
+
+static uint64_t clock_now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t time_us_64(void){
+    return clock_now() - clock_start;
+}
+uint32_t time_us_32(void){
+    return (uint32_t) time_us_64();
+}
+void sleep_us(uint64_t us){
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+void sleep_ms(uint32_t ms){
+    sleep_us((uint64_t) ms * 1000);
+}
+void __wfi(void){
+    sleep_us(1000);
+}
+uint32_t get_rand_32(void){
+    return ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+}
+//------------------------------------------------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------------------------
+//Trace replay - adc_read and the button
+static const uint16_t *trace_potv;
+static const bool *trace_button;
+static int trace_count = 0;
+static int trace_pos = 0;           //Next sample adc_read gives
+static bool trace_pressed = false;  //Button of the sample adc_read gave last
+static uint32_t walk = 2048;        //Random walk when there is no trace
+
+void host_trace_set(const uint16_t *potv, const bool *button, int count){
+    trace_potv = potv;
+    trace_button = button;
+    trace_count = count;
+    trace_pos = 0;
+}
+
+int host_trace_load(const char *path){
+    FILE *f = fopen(path, "r");
+    if(f == NULL){
+        return -1;
+    }
+    int cap = 1024;
+    int count = 0;
+    uint16_t *potv = malloc(cap * sizeof(*potv));
+    bool *button = malloc(cap * sizeof(*button));
+    char line[256];
+    while(fgets(line, sizeof(line), f)){
+        unsigned v = 0;
+        int b = 0;
+        //DUMP lines - Index: 3	Timestamp: 300091	Potentiometer 3535	Button: 0	LED: 1
+        char *dump = strstr(line, "Potentiometer ");
+        if(dump != NULL){
+            char *pressed = strstr(line, "Button: ");
+            sscanf(dump + 14, "%u", &v);
+            if(pressed != NULL){
+                sscanf(pressed + 8, "%d", &b);
+            }
+        }
+        else if(sscanf(line, "%u %d", &v, &b) < 1){
+            continue;
+        }
+        if(count == cap){
+            cap *= 2;
+            potv = realloc(potv, cap * sizeof(*potv));
+            button = realloc(button, cap * sizeof(*button));
+        }
+        potv[count] = v & 0xFFF;
+        button[count] = b != 0;
+        count ++;
+    }
+    fclose(f);
+    host_trace_set(potv, button, count);
+    return count;
+}
+
+void adc_init(void){}
+void adc_gpio_init(unsigned pin){}
+void adc_select_input(unsigned input){}
+
+uint16_t adc_read(void){
+    if(trace_count > 0){
+        trace_pressed = trace_button[trace_pos];
+        uint16_t v = trace_potv[trace_pos];
+        trace_pos = (trace_pos + 1) % trace_count;
+        return v;
+    }
+    walk = (walk + 4096 + rand() % 65 - 32) % 4096;
+    trace_pressed = (rand() % 5) == 0;
+    return walk;
+}
+
+void gpio_init(unsigned pin){}
+void gpio_set_dir(unsigned pin, bool out){}
+void gpio_pull_up(unsigned pin){}
+void gpio_put(unsigned pin, bool value){}
+//Only the button is ever read - active low
+bool gpio_get(unsigned pin){
+    return !trace_pressed;
+}
+
+//ADC FIFO and DMA - a thread stands in for the two chained channels, writing adc_read samples into the stream's blocks
+//in turn at sample_hz, HOST_DMA_CHUNK at a time, and raising the completion interrupt at the end of each block. Like the
+//real DMA it never waits for core0, so a consumer that falls behind gets blocks written over under it
+#define HOST_DMA_CHUNK 32   // Samples written between sleeps - the real DMA writes one per conversion
+static struct AdcStream *dma_stream;
+static uint32_t dma_button_pin;
+static uint32_t dma_hz;
+static uint64_t dma_start;
+
+//What adc_dma.c's DMA_IRQ_0 handler does once a channel has finished its block
+static void host_dma_irq(){
+    adc_stream_block_done(dma_stream, gpio_get(dma_button_pin) == 0);
+}
+
+static void *host_dma(void *arg){
+    uint64_t written = 0;
+    for(uint32_t n = 0; ; n++){
+        uint16_t *block = dma_stream->blocks[n & 1];
+        for(int i = 0; i < ADC_BLOCK_SAMPLES; i += HOST_DMA_CHUNK){
+            for(int k = i; k < i + HOST_DMA_CHUNK; k++){
+                block[k] = adc_read();
+            }
+            written += HOST_DMA_CHUNK;
+            //Paced off the sample count rather than the last sleep, so the rate does not drift
+            int64_t ahead = (int64_t)(written * 1000000 / dma_hz) - (int64_t)(time_us_64() - dma_start);
+            if(ahead > 0){
+                sleep_us(ahead);
+            }
+        }
+        host_dma_irq();
+    }
+    return NULL;
+}
+
+void adc_dma_start(struct AdcStream *stream, uint32_t sample_hz, uint32_t button_pin){
+    pthread_t thread;
+    dma_stream = stream;
+    dma_button_pin = button_pin;
+    dma_hz = sample_hz;
+    dma_start = time_us_64();
+    adc_stream_init(stream, sample_hz, (uint32_t) dma_start);
+    pthread_create(&thread, NULL, host_dma, NULL);
+}
+//------------------------------------------------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------------------------
+//Serial - stdin and stdout
+static void out_chars(const char *buf, int len){
+    fwrite(buf, 1, len, stdout);
+    fflush(stdout);
+}
+stdio_driver_t stdio_usb = {out_chars};
+
+uint32_t tud_cdc_write_available(void){
+    return 4096;
+}
+
+static void (*chars_available)(void*);
+static void *chars_param;
+static volatile bool stdin_closed = false;
+
+void stdio_init_all(void){
+    //Results go out as they are printed, like they would over USB
+    setvbuf(stdout, NULL, _IOLBF, 0);
+}
+
+int getchar_timeout_us(uint32_t timeout_us){
+    struct pollfd pfd = {0, POLLIN, 0};
+    unsigned char c;
+    if(stdin_closed || (poll(&pfd, 1, timeout_us / 1000) <= 0)){
+        return PICO_ERROR_TIMEOUT;
+    }
+    if(read(0, &c, 1) != 1){
+        stdin_closed = true;
+        return PICO_ERROR_TIMEOUT;
+    }
+    return c;
+}
+
+//Stands in for the USB interrupt - calls the callback whenever stdin has something, and ends the process a little after it closes
+static void *stdin_poller(void *arg){
+    while(!stdin_closed){
+        struct pollfd pfd = {0, POLLIN, 0};
+        if(poll(&pfd, 1, -1) > 0){
+            chars_available(chars_param);
+        }
+    }
+    sleep_ms(HOST_EOF_LINGER_MS);
+    fflush(stdout);
+    exit(0);
+}
+
+void stdio_set_chars_available_callback(void (*fn)(void*), void *param){
+    pthread_t thread;
+    chars_available = fn;
+    chars_param = param;
+    pthread_create(&thread, NULL, stdin_poller, NULL);
+}
+//------------------------------------------------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------------------------
+//Core1
+static void *core1_entry(void *entry){
+    ((void (*)(void)) entry)();
+    return NULL;
+}
+
+void multicore_launch_core1(void (*entry)(void)){
+    pthread_t thread;
+    pthread_create(&thread, NULL, core1_entry, (void*) entry);
+}
+//------------------------------------------------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------------------------
+//Flash
+uint8_t *host_flash;
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count){
+    for(size_t i = 0; i < count; i++){
+        host_flash[flash_offs + i] &= data[i];
+    }
+}
+void flash_range_erase(uint32_t flash_offs, size_t count){
+    memset(host_flash + flash_offs, 0xFF, count);
+}
+void flash_safe_execute_core_init(void){}
+int flash_safe_execute(void (*func)(void*), void *param, uint32_t enter_exit_timeout_ms){
+    func(param);
+    return PICO_OK;
+}
+//------------------------------------------------------------------------------------------------------------------------
+
+//Before main - the clock starts at 0, and flash and the trace are there before anything reads them
+__attribute__((constructor)) static void host_hal_init(){
+    clock_start = clock_now() - 1;
+    const char *path = getenv("PICO_HOST_FLASH");
+    if(path != NULL){
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        bool fresh = (fd >= 0) && (lseek(fd, 0, SEEK_END) < PICO_FLASH_SIZE_BYTES);
+        if((fd >= 0) && (ftruncate(fd, PICO_FLASH_SIZE_BYTES) == 0)){
+            host_flash = mmap(NULL, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(host_flash == MAP_FAILED){
+                host_flash = NULL;
+            }
+            else if(fresh){
+                memset(host_flash, 0xFF, PICO_FLASH_SIZE_BYTES);
+            }
+        }
+    }
+    if(host_flash == NULL){
+        host_flash = malloc(PICO_FLASH_SIZE_BYTES);
+        memset(host_flash, 0xFF, PICO_FLASH_SIZE_BYTES);
+    }
+    //A trace for adc_read to replay instead of the random walk
+    const char *trace = getenv("PICO_HOST_TRACE");
+    if((trace != NULL) && (host_trace_load(trace) <= 0)){
+        fprintf(stderr, "Could not read trace %s\n", trace);
+    }
+}
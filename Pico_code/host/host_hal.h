@@ -0,0 +1,16 @@
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+// Host-only controls for the stub HAL
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Samples adc_read and the button replay, in order and round again at the end - the arrays are used in place, not copied
+void host_trace_set(const uint16_t *potv, const bool *button, int count);
+
+// Load a trace file and replay it - one sample a line, either "potv" or "potv button", or the lines of a DUMP capture
+// Returns the samples loaded, -1 if the file could not be read
+int host_trace_load(const char *path);
+
+#endif
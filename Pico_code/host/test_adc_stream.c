@@ -0,0 +1,86 @@
+//ADC DMA ingest test - the fake DMA in host_hal.c fills the stream's two blocks from a counting trace while this drains
+//them with adc_stream_drain, first keeping up and then stalling long enough for blocks to be written over
+//Every sample must come out once, with the timestamp of its place in the stream, or be in a block counted as lost
+//Exits non-zero on the first failure, so it runs under ctest
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "adc_dma.h"
+#include "host_hal.h"
+
+#define TEST_HZ 40000           // 25 us a sample, so a sample's place in the stream is its time offset / 25
+#define TEST_US_PER_SAMPLE (1000000 / TEST_HZ)
+#define TEST_LEVELS 4096        // The trace counts up through every level and round again
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    }while(0)
+
+static struct AdcStream stream;
+static uint32_t start_time;
+static int64_t last_place = -1;
+static uint32_t delivered = 0;
+
+//Each sample is the trace value at its place in the stream, and places only go up - whole blocks at a time when one was lost
+static void sink(struct DataPoint point){
+    uint32_t offset = point.ms_time - start_time;
+    CHECK(offset % TEST_US_PER_SAMPLE == 0);
+    int64_t place = offset / TEST_US_PER_SAMPLE;
+    CHECK(point.potentiometer_value == place % TEST_LEVELS);
+    CHECK(place > last_place);
+    CHECK((place == last_place + 1) || (place % ADC_BLOCK_SAMPLES == 0));
+    last_place = place;
+    delivered ++;
+}
+
+//Every block the consumer has finished with was either delivered whole or counted as lost - with every place delivered
+//at most once and below the blocks drained, that leaves no room for a sample to go missing without being counted
+static void check_accounting(void){
+    CHECK(delivered + stream.lost * ADC_BLOCK_SAMPLES == stream.drained * ADC_BLOCK_SAMPLES);
+    CHECK(last_place < (int64_t) stream.drained * ADC_BLOCK_SAMPLES);
+}
+
+int main(void){
+    static uint16_t potv[TEST_LEVELS];
+    static bool button[TEST_LEVELS];
+    for(int i = 0; i < TEST_LEVELS; i++){
+        potv[i] = i;
+    }
+    host_trace_set(potv, button, TEST_LEVELS);
+    adc_dma_start(&stream, TEST_HZ, 15);
+    start_time = stream.next_time;
+    uint32_t block_us = ADC_BLOCK_SAMPLES * TEST_US_PER_SAMPLE;
+
+    //Keeping up - drained many times a block
+    while(stream.drained < 40){
+        adc_stream_drain(&stream, sink);
+        sleep_us(block_us / 16);
+    }
+    check_accounting();
+    uint32_t lost_keeping_up = stream.lost;
+
+    //Falling behind - the DMA goes round both blocks a few times before the next drain
+    for(int stall = 0; stall < 5; stall++){
+        sleep_us(block_us * 5);
+        adc_stream_drain(&stream, sink);
+        check_accounting();
+    }
+    CHECK(stream.lost > lost_keeping_up);
+
+    //And catching up again
+    uint32_t resume = stream.drained;
+    while(stream.drained < resume + 20){
+        adc_stream_drain(&stream, sink);
+        sleep_us(block_us / 16);
+    }
+    check_accounting();
+    printf("test_adc_stream: %u samples delivered over %u blocks, %u lost while keeping up, %u lost in all\n",
+           delivered, stream.drained, lost_keeping_up, stream.lost);
+    return 0;
+}
@@ -0,0 +1,217 @@
+//Flash log test - flash_log.c against a FlashDev backed by a file, the way it runs off the Pico
+//The file behaves like NOR flash: erase sets a sector to 0xFF and programming can only clear bits, so a page programmed
+//twice without an erase fails the test
+//  append  - rows come back from a scan in the order they went in, the staged page included
+//  wrap    - after several laps round the region only the newest pages are left, still in order, every sector worn the same
+//  reopen  - a log opened again from the file picks up after its last programmed page, staged rows are gone
+//  torn    - a head page half written by a reset is skipped, and the log carries on in the next sector
+//  failure - a page that fails to program is counted as lost and the scan steps over it
+//Exits non-zero on the first failure, so it runs under ctest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flash_log.h"
+
+#define TEST_SECTORS 8
+#define TEST_SIZE (TEST_SECTORS * FLASH_LOG_SECTOR)
+#define TEST_IMAGE "test_flash_log.img"
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    }while(0)
+
+//------------------------------------------------------------------------------------------------------------------------
+//File-backed FlashDev
+struct FileFlash {
+    FILE *file;
+    int erases[TEST_SECTORS];
+    int fail_programs;          // Programs still to fail before they work again
+};
+
+static void file_read(void *ctx, uint32_t offset, void *buf, uint32_t len){
+    struct FileFlash *flash = ctx;
+    CHECK(offset + len <= TEST_SIZE);
+    fseek(flash->file, offset, SEEK_SET);
+    CHECK(fread(buf, 1, len, flash->file) == len);
+}
+
+static bool file_program(void *ctx, uint32_t offset, const void *page){
+    struct FileFlash *flash = ctx;
+    CHECK(offset % FLASH_LOG_PAGE == 0);
+    if(flash->fail_programs > 0){
+        flash->fail_programs --;
+        return false;
+    }
+    uint8_t bytes[FLASH_LOG_PAGE];
+    const uint8_t *data = page;
+    file_read(ctx, offset, bytes, FLASH_LOG_PAGE);
+    for(int i = 0; i < FLASH_LOG_PAGE; i++){
+        CHECK(bytes[i] == 0xFF);
+        bytes[i] &= data[i];
+    }
+    fseek(flash->file, offset, SEEK_SET);
+    CHECK(fwrite(bytes, 1, FLASH_LOG_PAGE, flash->file) == FLASH_LOG_PAGE);
+    return true;
+}
+
+static bool file_erase(void *ctx, uint32_t offset){
+    struct FileFlash *flash = ctx;
+    CHECK(offset % FLASH_LOG_SECTOR == 0);
+    uint8_t erased[FLASH_LOG_SECTOR];
+    memset(erased, 0xFF, sizeof(erased));
+    fseek(flash->file, offset, SEEK_SET);
+    CHECK(fwrite(erased, 1, FLASH_LOG_SECTOR, flash->file) == FLASH_LOG_SECTOR);
+    flash->erases[offset / FLASH_LOG_SECTOR] ++;
+    return true;
+}
+
+static struct FileFlash flash;
+static const struct FlashDev dev = {&flash, TEST_SIZE, file_read, file_program, file_erase};
+
+//Close the file and open it again - anything not written to it is gone, like across a reset
+static void file_reopen(void){
+    fclose(flash.file);
+    flash.file = fopen(TEST_IMAGE, "r+b");
+    CHECK(flash.file != NULL);
+}
+//------------------------------------------------------------------------------------------------------------------------
+
+//Every field of a row comes from its timestamp, which goes up by one a row
+static struct DataPoint row(uint32_t t){
+    struct DataPoint point;
+    point.ms_time = t;
+    point.potentiometer_value = (t * 7) & 0xFFF;
+    point.button_pressed = (t % 3) == 0;
+    point.led_on = t & 1;
+    return point;
+}
+
+static uint32_t next_time = 1000;
+
+static void append(struct FlashLog *log, int rows){
+    for(int i = 0; i < rows; i++){
+        flash_log_append(log, row(next_time++));
+    }
+}
+
+//Scan the whole log and check its rows run from first to last without a gap - returns the number of rows, and the pages
+//that could not be read through unreadable
+static int scan(const struct FlashLog *log, uint32_t first, uint32_t last, int *unreadable){
+    struct FlashLogPage page;
+    int rows = 0;
+    *unreadable = 0;
+    uint32_t want = first;
+    for(uint32_t n = 0; n < flash_log_pages(log); n++){
+        if(!flash_log_read(log, n, &page)){
+            *unreadable += 1;
+            continue;
+        }
+        for(int i = 0; i < page.header.count; i++){
+            struct DataPoint point = flash_page_row(&page, i);
+            struct DataPoint expect = row(point.ms_time);
+            CHECK(point.ms_time == want);
+            CHECK(point.potentiometer_value == expect.potentiometer_value);
+            CHECK(point.button_pressed == expect.button_pressed);
+            CHECK(point.led_on == expect.led_on);
+            CHECK((point.ms_time >= page.header.summary.time_min) && (point.ms_time <= page.header.summary.time_max));
+            want ++;
+            rows ++;
+        }
+    }
+    CHECK(want == last + 1);
+    return rows;
+}
+
+int main(void){
+    flash.file = fopen(TEST_IMAGE, "w+b");
+    CHECK(flash.file != NULL);
+    uint8_t erased[TEST_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+    CHECK(fwrite(erased, 1, TEST_SIZE, flash.file) == TEST_SIZE);
+
+    //Append - two whole pages in flash and a few rows still staged
+    struct FlashLog log;
+    int unreadable;
+    flash_log_open(&log, &dev);
+    CHECK(log.span == 0);
+    append(&log, 2 * FLASH_PAGE_ROWS + 5);
+    CHECK(log.span == 2);
+    CHECK(scan(&log, 1000, next_time - 1, &unreadable) == 2 * FLASH_PAGE_ROWS + 5);
+    CHECK(unreadable == 0);
+
+    //Reopen - the staged rows never made it to flash
+    file_reopen();
+    flash_log_open(&log, &dev);
+    CHECK(log.span == 2);
+    next_time = 1000 + 2 * FLASH_PAGE_ROWS;
+    CHECK(scan(&log, 1000, next_time - 1, &unreadable) == 2 * FLASH_PAGE_ROWS);
+
+    //Wrap - five laps of the region, with the log opened again from the file halfway through
+    int lap = (TEST_SIZE / FLASH_LOG_PAGE) * FLASH_PAGE_ROWS;
+    append(&log, 2 * lap + lap / 2);
+    flash_log_flush(&log);
+    file_reopen();
+    flash_log_open(&log, &dev);
+    append(&log, 2 * lap + FLASH_PAGE_ROWS / 2);
+    //Everything but the sector erased last is still there, and the staged page after it
+    uint32_t kept = log.span * FLASH_PAGE_ROWS + log.stage.header.count;
+    CHECK(log.span == TEST_SIZE / FLASH_LOG_PAGE - FLASH_LOG_PAGES_PER_SECTOR + log.head % FLASH_LOG_PAGES_PER_SECTOR);
+    CHECK(scan(&log, next_time - kept, next_time - 1, &unreadable) == (int) kept);
+    CHECK(unreadable == 0);
+    for(int s = 1; s < TEST_SECTORS; s++){
+        CHECK(abs(flash.erases[s] - flash.erases[0]) <= 1);
+    }
+
+    //Torn - the head page gets a header and nothing else, as if the power went mid-program
+    //Fill the staged page first so every page in flash is full and the rows left can be counted from the pages
+    append(&log, FLASH_PAGE_ROWS - log.stage.header.count);
+    uint32_t torn = log.head;
+    if(torn % FLASH_LOG_PAGES_PER_SECTOR == 0){
+        //A sector's first page is erased just before it is programmed, so tear the one after it
+        append(&log, FLASH_PAGE_ROWS);
+        torn = log.head;
+    }
+    struct FlashPageHeader header;
+    memset(&header, 0xFF, sizeof(header));
+    header.magic = FLASH_LOG_MAGIC;
+    header.count = 1;
+    fseek(flash.file, torn * FLASH_LOG_PAGE, SEEK_SET);
+    CHECK(fwrite(&header, 1, 4, flash.file) == 4);
+    file_reopen();
+    flash_log_open(&log, &dev);
+    CHECK(log.head % FLASH_LOG_PAGES_PER_SECTOR == 0);
+    CHECK(log.head == (torn / FLASH_LOG_PAGES_PER_SECTOR + 1) * FLASH_LOG_PAGES_PER_SECTOR % (TEST_SIZE / FLASH_LOG_PAGE));
+    append(&log, 3 * FLASH_PAGE_ROWS);
+    uint32_t skipped = FLASH_LOG_PAGES_PER_SECTOR - torn % FLASH_LOG_PAGES_PER_SECTOR;
+    scan(&log, next_time - (log.span - skipped) * FLASH_PAGE_ROWS, next_time - 1, &unreadable);
+    //The torn page and the rest of its sector have no rows, and neither does the stage after three whole pages
+    CHECK(unreadable == (int) skipped + 1);
+
+    //Failure - one page does not program, the rows in it are lost and the scan goes round it
+    uint32_t lost_from = next_time;
+    flash.fail_programs = 1;
+    append(&log, FLASH_PAGE_ROWS);
+    CHECK(log.lost == 1);
+    append(&log, 2 * FLASH_PAGE_ROWS);
+    struct FlashLogPage page;
+    int pages_read = 0;
+    for(uint32_t n = 0; n < flash_log_pages(&log); n++){
+        if(flash_log_read(&log, n, &page)){
+            pages_read ++;
+            uint32_t t = flash_page_row(&page, 0).ms_time;
+            CHECK((t < lost_from) || (t >= lost_from + FLASH_PAGE_ROWS));
+        }
+    }
+    //Every page but the failed one and the torn sector's can be read back
+    CHECK(pages_read == (int)(log.span - skipped - 1));
+
+    fclose(flash.file);
+    remove(TEST_IMAGE);
+    printf("test_flash_log: %d rows a page, %d laps of %d sectors\n", FLASH_PAGE_ROWS, flash.erases[0], TEST_SECTORS);
+    return 0;
+}
@@ -0,0 +1,597 @@
+//Query compiler tests - the database core from main.c on the host HAL, like bench.c, with a small table filled straight
+//through table_insert and plans checked against what they should select and in what order
+//Rows in sel and text results (read back from stdout, which goes to test_query.out) are checked against answers worked
+//out here by brute force over the columns, first on TEST_ROWS rows and again once eviction has been rewriting a full table
+//Exits non-zero on the first failure, so it runs under ctest
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define main pico_main
+#include "../main.c"
+#undef main
+
+#define TEST_ROWS 500
+
+static FILE *report;
+static int out_fd;
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            fprintf(report, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    }while(0)
+
+//Compile and run sql, leaving its rows in sel - returns the row count, -1 if it did not compile
+static int run_sql(const char *sql, struct QueryPlan *plan){
+    if(!compile_query(sql, strlen(sql), plan)){
+        return -1;
+    }
+    run_plan(plan, time_us_32());
+    int count = cursor.count;
+    while(cursor.kind != CURSOR_IDLE){
+        cursor_step(time_us_32() + 1000000);
+    }
+    return count;
+}
+
+//A column repeated in ORDER BY only counts once - four times 32 bits of time used to be packed into the 64-bit key
+static void test_repeated_order_column(void){
+    struct QueryPlan plan;
+    CHECK(run_sql("SELECT * ORDER BY time,time,time,potv", &plan) == TEST_ROWS);
+    CHECK(plan.order_count == 2);
+    CHECK(plan.order_cols[0] == COL_TIME);
+    CHECK(plan.order_cols[1] == COL_POTV);
+    static uint16_t repeated[ARRAY_SIZE];
+    memcpy(repeated, sel, sizeof(repeated));
+    CHECK(run_sql("SELECT * ORDER BY time,potv", &plan) == TEST_ROWS);
+    CHECK(memcmp(repeated, sel, TEST_ROWS * sizeof(sel[0])) == 0);
+    for(int i = 1; i < TEST_ROWS; i++){
+        CHECK(time_col[repeated[i - 1]] <= time_col[repeated[i]]);
+    }
+
+    //Repeats of a key in front of the last one - butp,potv sorted, then the potv index
+    CHECK(run_sql("SELECT * ORDER BY butp,butp,potv,butp", &plan) == TEST_ROWS);
+    CHECK(plan.order_count == 2);
+    for(int i = 1; i < TEST_ROWS; i++){
+        int a = sel[i - 1];
+        int b = sel[i];
+        CHECK(column_value(COL_BUTP, a) <= column_value(COL_BUTP, b));
+        CHECK((column_value(COL_BUTP, a) < column_value(COL_BUTP, b)) || (potv_col[a] <= potv_col[b]));
+    }
+}
+
+//Column names are matched whole - anything else that looks like one turns the query down instead of running on the column
+//that happens to share its first letter
+static void test_column_names(void){
+    struct QueryPlan plan;
+    const char *sql = "SELECT time,potv WHERE ledo=1 ORDER BY butp";
+    CHECK(compile_query(sql, strlen(sql), &plan));
+    CHECK(plan.select == (COL_BIT(COL_TIME) | COL_BIT(COL_POTV)));
+    CHECK(plan.where_col == COL_LEDO);
+    CHECK((plan.order_count == 1) && (plan.order_cols[0] == COL_BUTP));
+    CHECK(run_sql("SELECT lede", &plan) == -1);
+    CHECK(run_sql("SELECT timex", &plan) == -1);
+    CHECK(run_sql("SELECT tim", &plan) == -1);
+    CHECK(run_sql("SELECT time WHERE pots>5", &plan) == -1);
+    CHECK(run_sql("SELECT time ORDER BY button", &plan) == -1);
+    CHECK(run_sql("SELECT MAX(pot)", &plan) == -1);
+    CHECK(run_sql("SELECT COUNT(*) GROUP BY bttn", &plan) == -1);
+    CHECK(run_sql("SELECT COUNT(*),MAX(potv) GROUP BY time/1000", &plan) > 0);
+}
+
+//Next row for the test table - potv has lots of ties, so the later sort keys matter
+//The LED is off for about 40 rows in every 155, so some zone map chunks have it on throughout and can be skipped
+static uint32_t next_t = 0;
+static struct DataPoint test_point(void){
+    struct DataPoint point;
+    next_t += 1000 + rand() % 64;
+    point.ms_time = next_t;
+    point.potentiometer_value = rand() % 64;
+    point.button_pressed = rand() % 2;
+    point.led_on = (next_t / 40000) % 4 != 0;
+    return point;
+}
+
+//potv_hist has every stored row at its level and nothing else
+static bool hist_matches_table(void){
+    static uint16_t levels[HIST_LEVELS];
+    memset(levels, 0, sizeof(levels));
+    int rows = (num_samples < ARRAY_SIZE) ? num_samples : ARRAY_SIZE;
+    for(int i = 0; i < rows; i++){
+        levels[potv_col[i]] ++;
+    }
+    return (potv_hist.count == (uint32_t) rows) && (memcmp(levels, potv_hist.levels, sizeof(levels)) == 0);
+}
+
+static int table_rows(void){
+    return (num_samples < ARRAY_SIZE) ? num_samples : ARRAY_SIZE;
+}
+
+//Run sql to the end and return everything it sent
+static const char *capture_sql(const char *sql){
+    static char text[1 << 18];
+    fflush(stdout);
+    CHECK(ftruncate(out_fd, 0) == 0);
+    struct QueryPlan plan;
+    run_sql(sql, &plan);
+    tx_flush(&tx);
+    fflush(stdout);
+    ssize_t len = pread(out_fd, text, sizeof(text) - 1, 0);
+    CHECK((len >= 0) && (len < (ssize_t) sizeof(text) - 1));
+    text[len] = 0;
+    return text;
+}
+
+//The rows of a text result - what comes after the preamble and header lines and before the trailer
+static const char *result_rows(const char *text, int *len){
+    for(int line = 0; line < 2; line++){
+        text = strchr(text, '\n');
+        CHECK(text != NULL);
+        text ++;
+    }
+    const char *end = strstr(text, "Time to query: ");
+    CHECK(end != NULL);
+    *len = end - text;
+    return text;
+}
+
+//A text result's rows are exactly expect
+static void check_rows_text(const char *sql, const char *expect){
+    int len;
+    const char *rows = result_rows(capture_sql(sql), &len);
+    if((len != (int) strlen(expect)) || (memcmp(rows, expect, len) != 0)){
+        fprintf(report, "%s gave\n%.*s\nexpected\n%s\n", sql, len, rows, expect);
+    }
+    CHECK((len == (int) strlen(expect)) && (memcmp(rows, expect, len) == 0));
+}
+
+//Negative, zero or positive as row a comes before, level with or after row b on the keys
+static int row_cmp(const int *keys, int num_keys, int a, int b){
+    for(int k = 0; k < num_keys; k++){
+        uint32_t x = column_value(keys[k], a);
+        uint32_t y = column_value(keys[k], b);
+        if(x != y){
+            return (x < y) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+//sel[0..count) holds every row that passes the plan's WHERE clause once each, and nothing else, in the plan's order - or
+//with no ORDER BY, in the order of the index or chunks the rows came from
+static void check_sel(const char *sql, const struct QueryPlan *plan, int count){
+    static uint8_t seen[ARRAY_SIZE];
+    memset(seen, 0, sizeof(seen));
+    int rows = table_rows();
+    int matching = 0;
+    for(int i = 0; i < rows; i++){
+        matching += (plan->where_col == COL_NONE) || op_match(plan->where_op, column_value(plan->where_col, i), plan->where_val);
+    }
+    if(count != matching){
+        fprintf(report, "%s gave %d rows, %d match\n", sql, count, matching);
+    }
+    CHECK(count == matching);
+    int natural = ((plan->where_col == COL_TIME) || (plan->where_col == COL_POTV)) ? plan->where_col : COL_NONE;
+    for(int i = 0; i < count; i++){
+        int row = sel[i];
+        CHECK((row < rows) && !seen[row]);
+        seen[row] = 1;
+        CHECK((plan->where_col == COL_NONE) || op_match(plan->where_op, column_value(plan->where_col, row), plan->where_val));
+        if(i == 0){
+            continue;
+        }
+        if(plan->order_count > 0){
+            int cmp = row_cmp(plan->order_cols, plan->order_count, sel[i - 1], row);
+            CHECK(plan->order_desc ? (cmp >= 0) : (cmp <= 0));
+        }
+        else if(natural != COL_NONE){
+            CHECK(column_value(natural, sel[i - 1]) <= column_value(natural, row));
+        }
+        else{
+            CHECK(sel[i - 1] < row);
+        }
+    }
+}
+
+//Every column and operator against values at and around the data, with and without ORDER BY - the time and potv ranges
+//come out of their indexes, butp and ledo go through the zone maps, and the rest are filtered on the way out of an index
+static void test_where(void){
+    const char *cols[] = {"time", "potv", "butp", "ledo"};
+    const char *ops[] = {"<", ">", "=", "<=", ">=", "!="};
+    const char *orders[] = {"", " ORDER BY time", " ORDER BY potv", " ORDER BY butp,potv", " ORDER BY ledo,time",
+                            " ORDER BY potv,butp,time"};
+    uint32_t mid_time = time_col[table_rows() / 2];
+    uint32_t vals[4][3] = {{time_col[0], mid_time, mid_time + 1}, {0, 31, 64}, {0, 1, 2}, {0, 1, 1}};
+    for(int c = 0; c < 4; c++){
+        for(int o = 0; o < 6; o++){
+            for(int v = 0; v < 3; v++){
+                for(int order = 0; order < 6; order++){
+                    for(int desc = 0; desc < ((order > 0) ? 2 : 1); desc++){
+                        char sql[128];
+                        struct QueryPlan plan;
+                        snprintf(sql, sizeof(sql), "SELECT time,potv WHERE %s%s%u%s%s", cols[c], ops[o], vals[c][v],
+                                 orders[order], desc ? " DESC" : "");
+                        int count = run_sql(sql, &plan);
+                        CHECK(count >= 0);
+                        check_sel(sql, &plan, count);
+                    }
+                }
+            }
+        }
+    }
+}
+
+//Chunks the zone maps rule out are never looked at - with the LED off in runs, ledo=0 only visits the chunks that hold one
+static void test_zone_skip(void){
+    struct QueryPlan plan;
+    int rows = table_rows();
+    int chunks = 0;
+    for(int z = 0; z * ZONE_ROWS < rows; z++){
+        bool off = false;
+        for(int i = z * ZONE_ROWS; (i < (z + 1) * ZONE_ROWS) && (i < rows); i++){
+            off |= !column_value(COL_LEDO, i);
+        }
+        chunks += off;
+    }
+    uint64_t scanned = stats.rows_scanned;
+    int count = run_sql("SELECT time WHERE ledo=0", &plan);
+    check_sel("SELECT time WHERE ledo=0", &plan, count);
+    CHECK(stats.rows_scanned - scanned <= (uint64_t) chunks * ZONE_ROWS);
+    CHECK(stats.rows_scanned - scanned < (uint64_t) rows);
+}
+
+//A page of a sorted result is the same rows, in the same order, as that stretch of the whole result - whether it came out
+//of an index, a top-k heap or (for a page too big for the heap) the full sort
+static void test_limit(void){
+    const char *orders[] = {"ORDER BY time", "ORDER BY potv", "ORDER BY butp,potv", "ORDER BY potv,butp", "ORDER BY time,potv,butp",
+                            "ORDER BY ledo,butp"};
+    const char *wheres[] = {"", " WHERE butp=1", " WHERE potv>20", " WHERE ledo=0"};
+    int pages[][2] = {{0, 0}, {1, 0}, {5, 0}, {10, 3}, {37, 100}, {20, 490}, {7, 600}, {TOPK_MAX + 1, 0}, {1000, 50}};
+    static uint16_t whole[ARRAY_SIZE];
+    for(int o = 0; o < 6; o++){
+        for(int w = 0; w < 4; w++){
+            for(int desc = 0; desc < 2; desc++){
+                char sql[128];
+                struct QueryPlan plan;
+                snprintf(sql, sizeof(sql), "SELECT time%s %s%s", wheres[w], orders[o], desc ? " DESC" : "");
+                int total = run_sql(sql, &plan);
+                check_sel(sql, &plan, total);
+                memcpy(whole, sel, total * sizeof(sel[0]));
+                for(int p = 0; p < 9; p++){
+                    int k = pages[p][0];
+                    int m = pages[p][1];
+                    snprintf(sql, sizeof(sql), "SELECT time%s %s%s LIMIT %d OFFSET %d", wheres[w], orders[o], desc ? " DESC" : "", k, m);
+                    int count = run_sql(sql, &plan);
+                    int expect = (m >= total) ? 0 : ((total - m < k) ? total - m : k);
+                    if((count != expect) || ((count > 0) && (memcmp(sel, whole + m, count * sizeof(sel[0])) != 0))){
+                        fprintf(report, "%s gave %d rows, %d of %d expected\n", sql, count, expect, total);
+                    }
+                    CHECK(count == expect);
+                    CHECK((count == 0) || (memcmp(sel, whole + m, count * sizeof(sel[0])) == 0));
+                }
+            }
+        }
+    }
+}
+
+//Aggregate results, with and without GROUP BY, against the groups worked out row by row
+static void check_agg(const char *sql){
+    struct QueryPlan plan;
+    CHECK(compile_query(sql, strlen(sql), &plan));
+    const struct AggSpec *spec = &plan.agg;
+    int rows = table_rows();
+    //Every group there is, lowest first
+    static uint32_t groups[ARRAY_SIZE];
+    int num_groups = 0;
+    for(int i = 0; i < rows; i++){
+        if((plan.where_col != COL_NONE) && !op_match(plan.where_op, column_value(plan.where_col, i), plan.where_val)){
+            continue;
+        }
+        uint32_t g = (spec->group_col == COL_NONE) ? 0 : column_value(spec->group_col, i) / spec->group_width;
+        bool known = false;
+        for(int k = 0; k < num_groups; k++){
+            known |= groups[k] == g;
+        }
+        if(!known){
+            int k = num_groups++;
+            while((k > 0) && (groups[k - 1] > g)){
+                groups[k] = groups[k - 1];
+                k --;
+            }
+            groups[k] = g;
+        }
+    }
+    //An ungrouped query has its one row even over no rows
+    if((num_groups == 0) && (spec->group_col == COL_NONE)){
+        groups[num_groups++] = 0;
+    }
+    static char expect[1 << 16];
+    expect[0] = 0;
+    int len = 0;
+    for(int k = 0; k < num_groups; k++){
+        if(spec->group_col != COL_NONE){
+            len += snprintf(expect + len, sizeof(expect) - len, "%u, ", groups[k] * spec->group_width);
+        }
+        for(int a = 0; a < spec->count; a++){
+            uint32_t n = 0;
+            uint32_t lo = UINT32_MAX;
+            uint32_t hi = 0;
+            uint64_t sum = 0;
+            for(int i = 0; i < rows; i++){
+                if((plan.where_col != COL_NONE) && !op_match(plan.where_op, column_value(plan.where_col, i), plan.where_val)){
+                    continue;
+                }
+                if((spec->group_col != COL_NONE) && (column_value(spec->group_col, i) / spec->group_width != groups[k])){
+                    continue;
+                }
+                uint32_t x = (spec->cols[a] == COL_NONE) ? 0 : column_value(spec->cols[a], i);
+                n ++;
+                sum += x;
+                lo = (x < lo) ? x : lo;
+                hi = (x > hi) ? x : hi;
+            }
+            const char *sep = (a < spec->count - 1) ? ", " : "\n";
+            if(spec->funcs[a] == AGG_COUNT){
+                len += snprintf(expect + len, sizeof(expect) - len, "%u%s", n, sep);
+            }
+            else if(n == 0){
+                len += snprintf(expect + len, sizeof(expect) - len, "NULL%s", sep);
+            }
+            else if(spec->funcs[a] == AGG_AVG){
+                unsigned long long avg = (sum * 100 + n / 2) / n;
+                len += snprintf(expect + len, sizeof(expect) - len, "%llu.%02llu%s", avg / 100, avg % 100, sep);
+            }
+            else{
+                unsigned long long value = (spec->funcs[a] == AGG_MIN) ? lo : (spec->funcs[a] == AGG_MAX) ? hi : sum;
+                len += snprintf(expect + len, sizeof(expect) - len, "%llu%s", value, sep);
+            }
+        }
+    }
+    check_rows_text(sql, expect);
+}
+
+static void test_aggregates(void){
+    check_agg("SELECT COUNT(*),MIN(potv),MAX(time),SUM(potv)");
+    check_agg("SELECT COUNT(*),MIN(potv),MAX(time),SUM(potv) WHERE potv>20 GROUP BY butp");
+    check_agg("SELECT COUNT(*),AVG(potv),MIN(time) GROUP BY potv/16");
+    check_agg("SELECT AVG(time),MAX(potv),COUNT(*) WHERE ledo=0");
+    check_agg("SELECT SUM(time),COUNT(butp),AVG(butp) GROUP BY time/100000");
+    check_agg("SELECT MIN(time),MAX(potv),COUNT(*) WHERE time>1000 GROUP BY ledo");
+    check_agg("SELECT COUNT(*),MIN(potv),AVG(potv) WHERE potv>100");
+    check_agg("SELECT COUNT(*),MAX(time) WHERE potv>100 GROUP BY butp");
+}
+
+//PERCENTILE is the nearest rank over the sorted potv column, and HISTOGRAM the non-empty bins of it
+static void test_percentile(void){
+    static uint32_t rows_at[ADC_LEVELS];
+    memset(rows_at, 0, sizeof(rows_at));
+    int rows = table_rows();
+    uint64_t sum = 0;
+    uint32_t hi = 0;
+    for(int i = 0; i < rows; i++){
+        rows_at[potv_col[i]] ++;
+        sum += potv_col[i];
+        hi = (potv_col[i] > hi) ? potv_col[i] : hi;
+    }
+    //The last fraction puts the rank half a row past the end of the lowest level, so rounding it down would give that level
+    int lowest = 0;
+    while(rows_at[lowest] == 0){
+        lowest ++;
+    }
+    uint32_t fractions[4] = {500000, 900000, 1000000, (uint64_t)(2 * rows_at[lowest] + 1) * 1000000 / (2 * rows)};
+    uint32_t levels[4];
+    for(int f = 0; f < 4; f++){
+        uint32_t rank = ((uint64_t) fractions[f] * rows + 999999) / 1000000;
+        rank = (rank < 1) ? 1 : rank;
+        uint32_t v = 0;
+        for(uint32_t below = 0; below + rows_at[v] < rank; v++){
+            below += rows_at[v];
+        }
+        levels[f] = v;
+    }
+    char expect[256];
+    unsigned long long avg = (sum * 100 + rows / 2) / rows;
+    snprintf(expect, sizeof(expect), "%u, %u, %d, %llu.%02llu\n", levels[0], levels[1], rows, avg / 100, avg % 100);
+    check_rows_text("SELECT PERCENTILE(potv),PERCENTILE(potv,0.9),COUNT(*),AVG(potv)", expect);
+    char sql[128];
+    snprintf(sql, sizeof(sql), "SELECT PERCENTILE(potv,1),MAX(potv),PERCENTILE(potv,0.%06u)", fractions[3]);
+    snprintf(expect, sizeof(expect), "%u, %u, %u\n", levels[2], hi, levels[3]);
+    CHECK(levels[3] > (uint32_t) lowest);
+    check_rows_text(sql, expect);
+
+    static char bins[1 << 12];
+    int len = 0;
+    for(int v = 0; v < ADC_LEVELS; v += 8){
+        uint32_t n = 0;
+        for(int k = v; k < v + 8; k++){
+            n += rows_at[k];
+        }
+        if(n > 0){
+            len += snprintf(bins + len, sizeof(bins) - len, "%d, %u\n", v, n);
+        }
+    }
+    check_rows_text("SELECT HISTOGRAM(potv,8)", bins);
+}
+
+//EXEC of a plan prepared with a ? runs just like the query with the value written in
+static void test_prepared(void){
+    struct QueryPlan prepared;
+    struct QueryPlan plan;
+    const char *sql = "SELECT time,potv WHERE potv>? ORDER BY butp,time";
+    CHECK(compile_query(sql, strlen(sql), &prepared));
+    CHECK(prepared.where_param);
+    int handle = plan_store(&prepared);
+    CHECK(!plan_load(handle, false, 0, &plan));
+    static uint16_t direct[ARRAY_SIZE];
+    uint32_t params[] = {0, 31, 62, 100};
+    for(int p = 0; p < 4; p++){
+        char written[128];
+        snprintf(written, sizeof(written), "SELECT time,potv WHERE potv>%u ORDER BY butp,time", params[p]);
+        int count = run_sql(written, &plan);
+        check_sel(written, &plan, count);
+        memcpy(direct, sel, count * sizeof(sel[0]));
+        CHECK(plan_load(handle, true, params[p], &plan));
+        run_plan(&plan, time_us_32());
+        CHECK(cursor.count == count);
+        CHECK(memcmp(direct, sel, count * sizeof(sel[0])) == 0);
+        while(cursor.kind != CURSOR_IDLE){
+            cursor_step(time_us_32() + 1000000);
+        }
+    }
+    CHECK(!plan_load(PLAN_CACHE_SIZE, false, 0, &plan));
+}
+
+//Once the table is full every sample takes the place of the oldest of the rows closest to the mean potv - the lower value
+//when two are as close
+static int evict_victim(void){
+    uint64_t sum = 0;
+    for(int i = 0; i < ARRAY_SIZE; i++){
+        sum += potv_col[i];
+    }
+    int best = -1;
+    int64_t best_dist = 0;
+    for(int i = 0; i < ARRAY_SIZE; i++){
+        int64_t dist = (int64_t) potv_col[i] * ARRAY_SIZE - (int64_t) sum;
+        dist = (dist < 0) ? -dist : dist;
+        bool closer = (best < 0) || (dist < best_dist) || ((dist == best_dist) && (potv_col[i] < potv_col[best])) ||
+                      ((dist == best_dist) && (potv_col[i] == potv_col[best]) && (time_col[i] < time_col[best]));
+        if(closer){
+            best = i;
+            best_dist = dist;
+        }
+    }
+    return best;
+}
+
+static void test_eviction(void){
+    while(num_samples < ARRAY_SIZE){
+        table_insert(test_point());
+    }
+    for(int i = 0; i < 300; i++){
+        CHECK(loop_var == evict_victim());
+        struct DataPoint point = test_point();
+        //Now and then a far off value, so the mean moves and the row picked is not always in the same bucket
+        if(i % 7 == 0){
+            point.potentiometer_value = 4000;
+        }
+        table_insert(point);
+        CHECK((time_col[loop_var] != point.ms_time) || (potv_col[loop_var] == point.potentiometer_value));
+    }
+    CHECK(loop_var == evict_victim());
+    CHECK(hist_matches_table());
+}
+
+//A result going out while samples keep evicting rows gives the rows the table held when it came in - and one that more
+//rows are overwritten under than the overlay holds is cut off
+static void test_snapshot(void){
+    static char before[1 << 18];
+    const char *sql = "SELECT time,potv,butp WHERE potv>20 ORDER BY potv,time";
+    strcpy(before, capture_sql(sql));
+    int len;
+    const char *rows = result_rows(before, &len);
+
+    fflush(stdout);
+    CHECK(ftruncate(out_fd, 0) == 0);
+    struct QueryPlan plan;
+    CHECK(compile_query(sql, strlen(sql), &plan));
+    uint32_t copied = stats.snap_rows;
+    run_plan(&plan, time_us_32());
+    CHECK(cursor.kind == CURSOR_SELECT);
+    for(int i = 0; i < SNAP_ROWS / 2; i++){
+        table_insert(test_point());
+        cursor_step(time_us_32());
+    }
+    while(cursor.kind != CURSOR_IDLE){
+        cursor_step(time_us_32() + 1000000);
+    }
+    CHECK(stats.snap_rows > copied);
+    CHECK(snap_count == 0);
+    fflush(stdout);
+    static char during[1 << 18];
+    ssize_t got = pread(out_fd, during, sizeof(during) - 1, 0);
+    CHECK(got > 0);
+    during[got] = 0;
+    int during_len;
+    const char *during_rows = result_rows(during, &during_len);
+    CHECK((during_len == len) && (memcmp(rows, during_rows, len) == 0));
+
+    uint32_t too_old = stats.snaps_too_old;
+    run_plan(&plan, time_us_32());
+    for(int i = 0; (i < 10 * SNAP_ROWS) && (cursor.kind != CURSOR_IDLE); i++){
+        table_insert(test_point());
+    }
+    CHECK(cursor.kind == CURSOR_IDLE);
+    CHECK(stats.snaps_too_old == too_old + 1);
+    CHECK(snap_count == 0);
+}
+
+//A HISTOGRAM going out over several loops reads the counts as they were when it came in, while ingest carries on - and is
+//cut off once more has come in than the hold takes
+static void test_hist_hold(void){
+    struct QueryPlan plan;
+    const char *sql = "SELECT HISTOGRAM(potv,1)";
+    CHECK(compile_query(sql, strlen(sql), &plan));
+    static struct Histogram before;
+    before = potv_hist;
+    run_plan(&plan, time_us_32());
+    CHECK(cursor.kind == CURSOR_HIST);
+    for(int i = 0; i < 10; i++){
+        table_insert(test_point());
+        cursor_step(time_us_32());
+        CHECK(memcmp(&before, &potv_hist, sizeof(before)) == 0);
+    }
+    while(cursor.kind != CURSOR_IDLE){
+        cursor_step(time_us_32() + 1000000);
+    }
+    CHECK(potv_hist.count == (uint32_t) table_rows());
+    CHECK(hist_matches_table());
+
+    uint32_t too_old = stats.snaps_too_old;
+    run_plan(&plan, time_us_32());
+    for(int i = 0; i <= HIST_HELD; i++){
+        table_insert(test_point());
+    }
+    CHECK(cursor.kind == CURSOR_IDLE);
+    CHECK(stats.snaps_too_old == too_old + 1);
+    CHECK(hist_matches_table());
+}
+
+int main(void){
+    report = fdopen(dup(1), "w");
+    setvbuf(report, NULL, _IONBF, 0);
+    out_fd = open("test_query.out", O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    CHECK(out_fd >= 0);
+    fflush(stdout);
+    dup2(out_fd, 1);
+
+    db_init();
+    srand(1);
+    for(int i = 0; i < TEST_ROWS; i++){
+        table_insert(test_point());
+    }
+
+    test_repeated_order_column();
+    test_column_names();
+    test_where();
+    test_zone_skip();
+    test_limit();
+    test_aggregates();
+    test_percentile();
+    test_prepared();
+    //Add rows, so after the tests that count on TEST_ROWS - then the same checks over a table eviction has been rewriting
+    test_eviction();
+    test_snapshot();
+    test_where();
+    test_limit();
+    test_aggregates();
+    test_percentile();
+    test_hist_hold();
+    fprintf(report, "test_query: ok\n");
+    return 0;
+}
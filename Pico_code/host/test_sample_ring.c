@@ -0,0 +1,101 @@
+//Sample ring stress test - a thread plays core1's sampler pushing as fast as it can while the main thread plays core0
+//popping, so the ring is full, empty and in between millions of times
+//  lossless - the producer tries again when the ring is full, every sample has to come out once and in order
+//  lossy    - the producer moves on like sampler_main does, samples out plus dropped has to equal samples pushed
+//Also built with ThreadSanitizer where the compiler has it (test_sample_ring_tsan), which catches a missing acquire/release
+//Exits non-zero on the first failure, so it runs under ctest
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sample_ring.h"
+
+#define TEST_SAMPLES 1000000
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    }while(0)
+
+static struct SampleRing ring;
+static bool lossless;
+static _Atomic bool producer_done;
+
+//Every field is worked out from the sample number, so a torn or stale slot shows up in any of them
+static struct DataPoint sample(uint32_t n){
+    struct DataPoint point;
+    point.ms_time = n;
+    point.potentiometer_value = (n * 7) & 0xFFF;
+    point.button_pressed = n & 1;
+    point.led_on = (n >> 1) & 1;
+    return point;
+}
+
+static void *producer(void *arg){
+    uint32_t n = 0;
+    while(n < TEST_SAMPLES){
+        if(sample_ring_push(&ring, sample(n)) || !lossless){
+            n ++;
+        }
+        else{
+            sched_yield();
+        }
+    }
+    atomic_store(&producer_done, true);
+    return NULL;
+}
+
+//Returns the samples popped - each one is checked against its own number and has to come after the one before
+static uint32_t consume(void){
+    uint32_t popped = 0;
+    int64_t last = -1;
+    struct DataPoint point;
+    while(true){
+        bool done = atomic_load(&producer_done);
+        if(!sample_ring_pop(&ring, &point)){
+            if(done){
+                return popped;
+            }
+            sched_yield();
+            continue;
+        }
+        struct DataPoint want = sample(point.ms_time);
+        CHECK(point.potentiometer_value == want.potentiometer_value);
+        CHECK(point.button_pressed == want.button_pressed);
+        CHECK(point.led_on == want.led_on);
+        CHECK((int64_t) point.ms_time > last);
+        CHECK(!lossless || (point.ms_time == last + 1));
+        last = point.ms_time;
+        popped ++;
+    }
+}
+
+static uint32_t run(bool retry){
+    pthread_t thread;
+    sample_ring_init(&ring);
+    lossless = retry;
+    atomic_store(&producer_done, false);
+    pthread_create(&thread, NULL, producer, NULL);
+    uint32_t popped = consume();
+    pthread_join(thread, NULL);
+    return popped;
+}
+
+int main(void){
+    uint32_t popped = run(true);
+    CHECK(popped == TEST_SAMPLES);
+    uint32_t retried = atomic_load(&ring.dropped);
+
+    popped = run(false);
+    uint32_t dropped = atomic_load(&ring.dropped);
+    CHECK(popped + dropped == TEST_SAMPLES);
+
+    printf("test_sample_ring: %u samples in order with %u full-ring retries, then %u through and %u dropped\n",
+           TEST_SAMPLES, retried, popped, dropped);
+    return 0;
+}
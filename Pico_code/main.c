@@ -5,85 +5,2282 @@
 #include <pico/time.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <unistd.h>
+#include "pico/stdio_usb.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
 // #include <string.h>
+#include "datapoint.h"
+#include "sample_ring.h"
+#include "adc_stream.h"
+#include "adc_dma.h"
+#include "rx_ring.h"
+#include "crc16.h"
+#include "flash_log.h"
+#include "flash_dev_pico.h"
+#include "ts_block.h"
+#include "stats.h"
+#include "tx_buf.h"
+#include "histogram.h"
+#include "tusb.h"
 
 #define POTENTIOMETER_PIN 26  // GPIO pin connected to the potentiometer
 #define BUTTON_PIN 15         // GPIO pin connected to the push button
 #define LED_PIN 25
-#define ARRAY_SIZE 16000       // Number of readings to store - 6370  entries to make DUMP take 1s - 3140 entries to make SELECT * ORDER BY time take 1s
-// Buffer size for the input string
-#define BUFFER_SIZE 128
-#define MS_BT_LOOP 100
-
-// Struct to hold potentiometer and button status
-struct DataPoint {
-    uint32_t ms_time;               // Timestamp in ms
-    uint16_t potentiometer_value;   // ADC value
-    bool button_pressed;            // Button status
-    bool led_on;                    // LED status
+#ifndef ARRAY_SIZE              // The host benchmarks build one table size after another
+#define ARRAY_SIZE 12000       // Number of readings to store - about 16.5 bytes of SRAM each across the columns, indexes, zone maps and sort buffers (~215 KB of the 264 KB with the potv histogram)
+#endif
+#define MS_BT_LOOP 100        // Sampling period on core1
+#define ADC_DMA_HZ 0           // 0 samples on core1's MS_BT_LOOP timer - set a rate (733 to 500000 Hz) to sample with the ADC FIFO and DMA instead
+#define MS_SERVE_LOOP 10       // Loop period on core0 - how often serial input, new samples and results in flight get looked at
+#define QUERY_BUDGET_US (MS_SERVE_LOOP * 750)   // Time per loop a DUMP or SELECT result gets to send rows before yielding
+#define FLASH_LOG 1            // 1 appends every sample to the log in flash as well (flash_log.h) - turn off for high ADC_DMA_HZ rates
+#define TS_BLOCKS 0            // 256 byte compressed blocks of history kept in SRAM as well (ts_block.h) - 0 for none, take 16 off ARRAY_SIZE for each one
+
+// Columnar table - one array per column of TABLE_COLUMNS (datapoint.h), name_col, so a scan over one column only pulls that
+// column through memory. BIT columns are packed 32 rows to a word instead of taking a padded byte each
+#define BITMAP_WORDS ((ARRAY_SIZE + 31) / 32)
+#define COLUMN_ARRAY_U32(name) static uint32_t name[ARRAY_SIZE];
+#define COLUMN_ARRAY_U16(name) static uint16_t name[ARRAY_SIZE];
+#define COLUMN_ARRAY_BIT(name) static uint32_t name[BITMAP_WORDS];
+#define COLUMN_ARRAY(ID, name, storage, key_bits, field, sample, dump_label) COLUMN_ARRAY_##storage(name##_col)
+TABLE_COLUMNS(COLUMN_ARRAY)
+
+// Column ids - COL_BIT(col) is the column's bit in a select mask, the same bits the binary header uses
+#define COLUMN_ID(ID, name, storage, key_bits, field, sample, dump_label) COL_##ID,
+enum { TABLE_COLUMNS(COLUMN_ID) NUM_COLS };
+#define COL_NONE -1             // COUNT(*), no WHERE column, no GROUP BY column
+#define COL_BIT(col) ((1 << (NUM_COLS - 1)) >> (col))
+#define ALL_COLS ((1 << NUM_COLS) - 1)
+_Static_assert(NUM_COLS <= 8, "Select masks are a byte in the binary header");
+
+/*
+TODO:
+1. Final topology out of options: Pi side
+2. Epochs: determined experimentally, but pico needs a window to send and receive data: solved here and Pi side
+3. Table: DataPoint Struct - solved here mostly but needs stuff on Pi side to make it better maybe - maybe determine max memory footprint here?
+    3.1. Kick out data: store variable and index to kick out data with lowest deltas to replace with most current data (potentiometer value) - find out how much time's worth of data can be stored on the pico before the table fills up
+4. SQL Logic: Unsolved - dissect message into SELECT, WHERE, and ORDER BY and then do table shenanigans
+5. Parameters: Unsolved - Pi level vs Pico level query processing - epochs
+*/
+
+bool buf_comp(uint8_t *buf1, uint8_t *buf2, int len){
+    for(int i = 0; i < len; i++){
+        if(buf1[i] != buf2[i]){
+            return true;
+        }
+    }
+    return false;
+}
+
+//Bitmap column accessors
+static inline bool bit_get(const uint32_t *bits, int i){
+    return (bits[i >> 5] >> (i & 31)) & 1u;
+}
+static inline void bit_put(uint32_t *bits, int i, bool value){
+    if(value){
+        bits[i >> 5] |= (1u << (i & 31));
+    }
+    else{
+        bits[i >> 5] &= ~(1u << (i & 31));
+    }
+}
+
+//Reading and writing one value of a column, by storage kind
+#define COLUMN_LOAD_U32(col, i) (col)[i]
+#define COLUMN_LOAD_U16(col, i) (col)[i]
+#define COLUMN_LOAD_BIT(col, i) bit_get(col, i)
+#define COLUMN_STORE_U32(col, i, value) (col)[i] = (value)
+#define COLUMN_STORE_U16(col, i, value) (col)[i] = (value)
+#define COLUMN_STORE_BIT(col, i, value) bit_put(col, i, value)
+
+//Gather a row back out of the columns
+#define GET_FIELD(ID, name, storage, key_bits, field, sample, dump_label) point.field = COLUMN_LOAD_##storage(name##_col, i);
+struct DataPoint get_row(int i){
+    struct DataPoint point;
+    TABLE_COLUMNS(GET_FIELD)
+    return point;
+}
+//Scatter a row into the columns
+#define PUT_FIELD(ID, name, storage, key_bits, field, sample, dump_label) COLUMN_STORE_##storage(name##_col, i, point.field);
+void put_row(int i, struct DataPoint point){
+    TABLE_COLUMNS(PUT_FIELD)
+}
+//One column of one row
+#define COLUMN_VALUE_CASE(ID, name, storage, key_bits, field, sample, dump_label) case COL_##ID: return COLUMN_LOAD_##storage(name##_col, row);
+static inline uint32_t column_value(int col, int row){
+    switch(col){
+        TABLE_COLUMNS(COLUMN_VALUE_CASE)
+    }
+    return 0;
+}
+//One column of a row that is not in the table
+#define POINT_VALUE_CASE(ID, name, storage, key_bits, field, sample, dump_label) case COL_##ID: return point.field;
+static inline uint32_t point_value(int col, struct DataPoint point){
+    switch(col){
+        TABLE_COLUMNS(POINT_VALUE_CASE)
+    }
+    return 0;
+}
+#define COLUMN_NAME_CASE(ID, name, storage, key_bits, field, sample, dump_label) case COL_##ID: return #name;
+const char *column_name(int col){
+    switch(col){
+        TABLE_COLUMNS(COLUMN_NAME_CASE)
+    }
+    return "*";
+}
+
+//Snapshot reads - a result in flight sees the table as it was when it started, while ingest carries on without a PAUSE
+//Ingest only ever overwrites the one row eviction picked, so just before a row the result could still read is overwritten its
+//old values are copied into a small overlay and the row is marked, and the result reads marked rows out of the overlay
+//Only rows ingest actually touches are copied, and the overlay is emptied when the result finishes
+#define SNAP_ROWS 256                           // Rows the overlay holds - a result still going when it fills up is cut off
+static bool snap_open = false;                  // A result is reading rows out of sel
+static uint32_t snap_dirty[BITMAP_WORDS];       // Rows overwritten since it started
+static int snap_count = 0;                      // Overlay entries in use
+static uint16_t snap_rows[SNAP_ROWS];           // Row each entry is for
+static struct DataPoint snap_points[SNAP_ROWS]; // What that row held when the result started
+
+//Row is about to be overwritten and held old - false when it needed copying and the overlay is full
+bool snap_save(int row, struct DataPoint old){
+    if(!snap_open || bit_get(snap_dirty, row)){
+        return true;
+    }
+    if(snap_count == SNAP_ROWS){
+        return false;
+    }
+    snap_rows[snap_count] = row;
+    snap_points[snap_count++] = old;
+    bit_put(snap_dirty, row, true);
+    return true;
+}
+
+//The result is done - unmark only the rows it copied rather than clearing the whole bitmap
+void snap_release(){
+    for(int e = 0; e < snap_count; e++){
+        bit_put(snap_dirty, snap_rows[e], false);
+    }
+    snap_count = 0;
+    snap_open = false;
+}
+
+static inline bool snap_dirty_row(int row){
+    return (snap_count > 0) && bit_get(snap_dirty, row);
+}
+
+//A row as the result in flight sees it
+struct DataPoint snap_get_row(int row){
+    if(snap_dirty_row(row)){
+        int e = 0;
+        while(snap_rows[e] != row){
+            e ++;
+        }
+        return snap_points[e];
+    }
+    return get_row(row);
+}
+
+//One column of that, straight from the column unless the row was overwritten
+#define SNAP_LOAD(storage, col, field, row) (snap_dirty_row(row) ? snap_get_row(row).field : COLUMN_LOAD_##storage(col, row))
+
+//Eviction index - rows bucketed by potentiometer value so the row closest to the mean can be found without a scan
+//Each bucket is a circular list kept in insertion order, potv_tail points at the newest row and its next is the oldest
+#define ADC_LEVELS 4096     // adc_read() returns a 12-bit value
+#define NO_ROW 0xFFFF       // Empty bucket marker
+_Static_assert(ARRAY_SIZE < NO_ROW, "row ids are stored as uint16_t");
+static uint16_t potv_tail[ADC_LEVELS];          // Newest row in each bucket
+static uint16_t potv_next[ARRAY_SIZE];          // Next row in the same bucket
+static uint32_t potv_used[ADC_LEVELS / 32];     // Bit set for every non-empty bucket
+static uint32_t potv_sum = 0;                   // Running sum of the potv column
+static struct Histogram potv_hist;              // Rows at every potv level, for PERCENTILE and HISTOGRAM
+_Static_assert(HIST_LEVELS == ADC_LEVELS, "potv_hist has a count for every ADC reading");
+
+//A PERCENTILE or HISTOGRAM result reads potv_hist over several loops, so while one is open the changes ingest makes to the
+//counts are held back and only put in when it finishes - the same idea as the row overlay, and like it a result still going
+//when the hold fills up is cut off
+#define HIST_HELD 256                           // Changes the hold takes - a row in and a row out for every eviction
+#define HIST_HELD_OUT 0x8000                    // Held change is a row going out, not coming in
+static bool hist_hold = false;                  // A result is reading potv_hist
+static int hist_held_count = 0;
+static uint16_t hist_held[HIST_HELD];
+
+static inline void hist_change(uint16_t v, bool in){
+    if(hist_hold){
+        hist_held[hist_held_count++] = in ? v : (v | HIST_HELD_OUT);
+    }
+    else if(in){
+        hist_add(&potv_hist, v);
+    }
+    else{
+        hist_remove(&potv_hist, v);
+    }
+}
+
+//Room for this many more changes - false when the result holding the counts has to be cut off first
+static inline bool hist_room(int changes){
+    return !hist_hold || (hist_held_count + changes <= HIST_HELD);
+}
+
+//The result is done - put in everything ingest did while it was open
+void hist_release(){
+    hist_hold = false;
+    for(int c = 0; c < hist_held_count; c++){
+        hist_change(hist_held[c] & ~HIST_HELD_OUT, !(hist_held[c] & HIST_HELD_OUT));
+    }
+    hist_held_count = 0;
+}
+
+//Time index - doubly linked list of rows from oldest to newest
+//New samples always carry the newest timestamp, so inserting is an append and eviction is an unlink from wherever the row sits
+static uint16_t time_prev[ARRAY_SIZE];
+static uint16_t time_next[ARRAY_SIZE];
+static uint16_t time_oldest = NO_ROW;
+static uint16_t time_newest = NO_ROW;
+//Number of neighbouring pairs in the list whose timestamps go backwards - only non-zero after time_us_32() wraps
+//Range walks can only stop early while this is zero
+static int time_descents = 0;
+
+void index_init(){
+    time_oldest = NO_ROW;
+    time_newest = NO_ROW;
+    time_descents = 0;
+    for(int v = 0; v < ADC_LEVELS; v++){
+        potv_tail[v] = NO_ROW;
+    }
+    for(int w = 0; w < ADC_LEVELS / 32; w++){
+        potv_used[w] = 0;
+    }
+    potv_sum = 0;
+    hist_init(&potv_hist);
+}
+
+//Add a row to the back of its bucket - call after put_row
+void potv_link(int row){
+    uint16_t v = potv_col[row];
+    uint16_t tail = potv_tail[v];
+    if(tail == NO_ROW){
+        potv_next[row] = row;
+        potv_used[v >> 5] |= (1u << (v & 31));
+    }
+    else{
+        potv_next[row] = potv_next[tail];
+        potv_next[tail] = row;
+    }
+    potv_tail[v] = row;
+    potv_sum += v;
+    hist_change(v, true);
+}
+
+//Take a row out of its bucket - call before its columns are overwritten
+//Rows picked by evict_pick are always at the front of their bucket, so this does not walk the list
+void potv_unlink(int row){
+    uint16_t v = potv_col[row];
+    uint16_t tail = potv_tail[v];
+    uint16_t prev = tail;
+    while(potv_next[prev] != row){
+        prev = potv_next[prev];
+    }
+    if(prev == row){
+        //Only row in the bucket
+        potv_tail[v] = NO_ROW;
+        potv_used[v >> 5] &= ~(1u << (v & 31));
+    }
+    else{
+        potv_next[prev] = potv_next[row];
+        if(tail == row){
+            potv_tail[v] = prev;
+        }
+    }
+    potv_sum -= v;
+    hist_change(v, false);
+}
+
+//Append the newest row to the time index - call after put_row
+void time_link(int row){
+    time_prev[row] = time_newest;
+    time_next[row] = NO_ROW;
+    if(time_newest == NO_ROW){
+        time_oldest = row;
+    }
+    else{
+        time_next[time_newest] = row;
+        time_descents += time_col[row] < time_col[time_newest];
+    }
+    time_newest = row;
+}
+
+//Take a row out of the time index - call before its columns are overwritten
+void time_unlink(int row){
+    uint16_t prev = time_prev[row];
+    uint16_t next = time_next[row];
+    if(prev != NO_ROW){
+        time_descents -= time_col[row] < time_col[prev];
+        time_next[prev] = next;
+    }
+    else{
+        time_oldest = next;
+    }
+    if(next != NO_ROW){
+        time_descents -= time_col[next] < time_col[row];
+        time_prev[next] = prev;
+    }
+    else{
+        time_newest = prev;
+    }
+    if((prev != NO_ROW) && (next != NO_ROW)){
+        time_descents += time_col[next] < time_col[prev];
+    }
+}
+
+//Highest non-empty bucket at or below v, -1 if there is none
+int potv_used_below(int v){
+    int w = v >> 5;
+    uint32_t bits = potv_used[w] & (0xFFFFFFFFu >> (31 - (v & 31)));
+    while(bits == 0){
+        if(--w < 0){
+            return -1;
+        }
+        bits = potv_used[w];
+    }
+    return (w << 5) + 31 - __builtin_clz(bits);
+}
+
+//Lowest non-empty bucket at or above v, -1 if there is none
+int potv_used_above(int v){
+    if(v >= ADC_LEVELS){
+        return -1;
+    }
+    int w = v >> 5;
+    uint32_t bits = potv_used[w] & (0xFFFFFFFFu << (v & 31));
+    while(bits == 0){
+        if(++w >= ADC_LEVELS / 32){
+            return -1;
+        }
+        bits = potv_used[w];
+    }
+    return (w << 5) + __builtin_ctz(bits);
+}
+
+//Row to evict out of n stored rows - the oldest row in the bucket closest to the mean potv
+//Costs at most one pass over the 128 word bucket bitmap no matter how big the table is
+int evict_pick(int n){
+    int floor_mean = potv_sum / n;
+    int below = potv_used_below(floor_mean);
+    int above = potv_used_above(floor_mean + 1);
+    int v = below;
+    if(below < 0){
+        v = above;
+    }
+    else if(above >= 0){
+        //Compare |value - sum / n| scaled by n so it stays in integers
+        int64_t below_dist = (int64_t)potv_sum - (int64_t)below * n;
+        int64_t above_dist = (int64_t)above * n - (int64_t)potv_sum;
+        if(above_dist < below_dist){
+            v = above;
+        }
+    }
+    return potv_next[potv_tail[v]];
+}
+
+//Selection vector - row ids that survived the WHERE clause, in output order
+static uint16_t sel[ARRAY_SIZE];
+
+//WHERE operators
+#define OP_LT 1
+#define OP_GT 2
+#define OP_EQ 3
+#define OP_LE 4
+#define OP_GE 5
+#define OP_NE 6
+
+//Check a value against a WHERE operator
+static inline bool op_match(int op, uint32_t x, uint32_t val){
+    switch(op){
+        case OP_LT: return x < val;
+        case OP_GT: return x > val;
+        case OP_EQ: return x == val;
+        case OP_LE: return x <= val;
+        case OP_GE: return x >= val;
+        case OP_NE: return x != val;
+    }
+    return false;
+}
+
+//Whether anything between lo and hi can pass a WHERE operator
+static inline bool range_match(int op, uint32_t lo, uint32_t hi, uint32_t val){
+    switch(op){
+        case OP_LT: return lo < val;
+        case OP_GT: return hi > val;
+        case OP_EQ: return (lo <= val) && (val <= hi);
+        case OP_LE: return lo <= val;
+        case OP_GE: return hi >= val;
+        case OP_NE: return (lo != val) || (hi != val);
+    }
+    return false;
+}
+
+//Zone maps - the ranges of every ZONE_ROWS rows of the table, so a scan can skip the chunks a WHERE clause rules out
+//Inserting a row widens its chunk's ranges; evicting the row that held one of the ends rescans the chunk so they stay tight
+//U32 and U16 columns keep a min and max, BIT columns a count of the ones so eviction can take them back out exactly - all
+//generated from TABLE_COLUMNS by storage kind
+#define ZONE_ROWS 64
+#define NUM_ZONES ((ARRAY_SIZE + ZONE_ROWS - 1) / ZONE_ROWS)
+#define ZONE_ONES_U32(name)
+#define ZONE_ONES_U16(name)
+#define ZONE_ONES_BIT(name) uint8_t name##_ones;
+#define ZONE_ONES(ID, name, storage, key_bits, field, sample, dump_label) ZONE_ONES_##storage(name)
+struct Zone {
+    TABLE_COLUMNS(RANGE_FIELDS)
+    TABLE_COLUMNS(ZONE_ONES)
+    uint8_t rows;           // Rows written into the chunk so far
+};
+static struct Zone zones[NUM_ZONES];
+
+#define ZONE_WIDEN_RANGE(name) \
+    if(name##_col[row] < zone->name##_min) zone->name##_min = name##_col[row]; \
+    if(name##_col[row] > zone->name##_max) zone->name##_max = name##_col[row];
+#define ZONE_WIDEN_U32(name) ZONE_WIDEN_RANGE(name)
+#define ZONE_WIDEN_U16(name) ZONE_WIDEN_RANGE(name)
+#define ZONE_WIDEN_BIT(name) zone->name##_ones += bit_get(name##_col, row);
+#define ZONE_WIDEN(ID, name, storage, key_bits, field, sample, dump_label) ZONE_WIDEN_##storage(name)
+static inline void zone_widen(struct Zone *zone, int row){
+    TABLE_COLUMNS(ZONE_WIDEN)
+}
+
+//Work a chunk's ranges out again from its rows
+#define ZONE_CLEAR_U32(name) zone->name##_min = UINT32_MAX; zone->name##_max = 0;
+#define ZONE_CLEAR_U16(name) zone->name##_min = UINT16_MAX; zone->name##_max = 0;
+#define ZONE_CLEAR_BIT(name) zone->name##_ones = 0;
+#define ZONE_CLEAR(ID, name, storage, key_bits, field, sample, dump_label) ZONE_CLEAR_##storage(name)
+void zone_rebuild(int z){
+    struct Zone *zone = &zones[z];
+    int first = z * ZONE_ROWS;
+    TABLE_COLUMNS(ZONE_CLEAR)
+    for(int row = first; row < first + zone->rows; row++){
+        zone_widen(zone, row);
+    }
+}
+
+//Row has just been written with a new sample - old is what was there before, NULL if it was empty
+#define ZONE_AT_END_RANGE(name, field) at_end |= (old->field == zone->name##_min) || (old->field == zone->name##_max);
+#define ZONE_AT_END_U32(name, field) ZONE_AT_END_RANGE(name, field)
+#define ZONE_AT_END_U16(name, field) ZONE_AT_END_RANGE(name, field)
+#define ZONE_AT_END_BIT(name, field)
+#define ZONE_AT_END(ID, name, storage, key_bits, field, sample, dump_label) ZONE_AT_END_##storage(name, field)
+static inline bool zone_at_end(const struct Zone *zone, const struct DataPoint *old){
+    bool at_end = false;
+    TABLE_COLUMNS(ZONE_AT_END)
+    return at_end;
+}
+#define ZONE_TAKE_OUT_U32(name, field)
+#define ZONE_TAKE_OUT_U16(name, field)
+#define ZONE_TAKE_OUT_BIT(name, field) zone->name##_ones -= old->field;
+#define ZONE_TAKE_OUT(ID, name, storage, key_bits, field, sample, dump_label) ZONE_TAKE_OUT_##storage(name, field)
+void zone_update(int row, const struct DataPoint *old){
+    struct Zone *zone = &zones[row / ZONE_ROWS];
+    if(old == NULL){
+        zone->rows ++;
+        if(zone->rows == 1){
+            zone_rebuild(row / ZONE_ROWS);
+            return;
+        }
+    }
+    else{
+        if(zone_at_end(zone, old)){
+            zone_rebuild(row / ZONE_ROWS);
+            return;
+        }
+        TABLE_COLUMNS(ZONE_TAKE_OUT)
+    }
+    zone_widen(zone, row);
+}
+
+//A BIT column can hold no ones, no zeros or both - its range is 0 to 0, 1 to 1 or 0 to 1
+#define ZONE_MATCH_U32(name) range_match(op, zone->name##_min, zone->name##_max, val)
+#define ZONE_MATCH_U16(name) range_match(op, zone->name##_min, zone->name##_max, val)
+#define ZONE_MATCH_BIT(name) range_match(op, (zone->name##_ones == zone->rows) ? 1 : 0, (zone->name##_ones > 0) ? 1 : 0, val)
+#define ZONE_MATCH_CASE(ID, name, storage, key_bits, field, sample, dump_label) case COL_##ID: return ZONE_MATCH_##storage(name);
+bool zone_may_match(const struct Zone *zone, int col, int op, uint32_t val){
+    switch(col){
+        TABLE_COLUMNS(ZONE_MATCH_CASE)
+    }
+    return true;
+}
+
+//Candidate rows for a WHERE clause with no index to go on - every row of the chunks that might hold a match, in row order
+int zone_scan(int col, int op, uint32_t val, int arr_len){
+    int count = 0;
+    for(int z = 0; z * ZONE_ROWS < arr_len; z++){
+        if(!zone_may_match(&zones[z], col, op, val)){
+            continue;
+        }
+        int last = (z + 1) * ZONE_ROWS;
+        if(last > arr_len){
+            last = arr_len;
+        }
+        for(int row = z * ZONE_ROWS; row < last; row++){
+            sel[count++] = row;
+        }
+    }
+    return count;
+}
+
+//Fill sel with every row, oldest first - or only the first limit of them
+int time_walk(int limit){
+    int count = 0;
+    for(int row = time_oldest; (row != NO_ROW) && (count < limit); row = time_next[row]){
+        sel[count++] = row;
+    }
+    return count;
+}
+
+//Fill sel with the newest limit rows, newest first - ORDER BY time DESC LIMIT k walks k rows in from the new end
+int time_latest(int limit){
+    int count = 0;
+    for(int row = time_newest; (row != NO_ROW) && (count < limit); row = time_prev[row]){
+        sel[count++] = row;
+    }
+    return count;
+}
+
+//Fill sel with the rows whose timestamp passes the WHERE predicate, oldest first, stopping at limit of them
+//While the index is in timestamp order only the matching rows and the one row past the boundary are visited
+int time_range(int op, uint32_t val, int limit){
+    int count = 0;
+    if(time_descents != 0 || op == OP_NE){
+        for(int row = time_oldest; (row != NO_ROW) && (count < limit); row = time_next[row]){
+            if(op_match(op, time_col[row], val)){
+                sel[count++] = row;
+            }
+        }
+    }
+    else if(op == OP_LT || op == OP_LE){
+        //Matches are a run at the old end
+        for(int row = time_oldest; (row != NO_ROW) && (count < limit); row = time_next[row]){
+            if(!op_match(op, time_col[row], val)){
+                break;
+            }
+            sel[count++] = row;
+        }
+    }
+    else{
+        //Matches for >, >= and = are a run at the new end - walk it backwards and then flip it to oldest first
+        for(int row = time_newest; row != NO_ROW; row = time_prev[row]){
+            if(time_col[row] < val || (op == OP_GT && time_col[row] == val)){
+                break;
+            }
+            if(op_match(op, time_col[row], val)){
+                sel[count++] = row;
+            }
+        }
+        for(int a = 0, b = count - 1; a < b; a++, b--){
+            uint16_t tmp = sel[a];
+            sel[a] = sel[b];
+            sel[b] = tmp;
+        }
+        //The oldest matches are only known once the whole run has been walked
+        if(count > limit){
+            count = limit;
+        }
+    }
+    return count;
+}
+
+//Fill sel with the rows whose potv passes the WHERE predicate, in potv order, stopping at limit of them
+//Only non-empty buckets inside the predicate's range are visited, each one oldest row first
+int potv_range(int op, int val, int limit){
+    int lo = 0;
+    int hi = ADC_LEVELS - 1;
+    if(op == OP_LT) hi = val - 1;
+    if(op == OP_GT) lo = val + 1;
+    if(op == OP_EQ) lo = hi = val;
+    if(op == OP_LE) hi = val;
+    if(op == OP_GE) lo = val;
+    if(hi >= ADC_LEVELS) hi = ADC_LEVELS - 1;
+    int count = 0;
+    for(int v = potv_used_above(lo); (v >= 0) && (v <= hi); v = potv_used_above(v + 1)){
+        if((op == OP_NE) && (v == val)){
+            continue;
+        }
+        uint16_t first = potv_next[potv_tail[v]];
+        uint16_t row = first;
+        do{
+            if(count == limit){
+                return count;
+            }
+            sel[count++] = row;
+            row = potv_next[row];
+        } while(row != first);
+    }
+    return count;
+}
+
+//Fill sel with every row in potv order - a counting sort that the bucket index has already done
+int potv_walk(int limit){
+    return potv_range(OP_GE, 0, limit);
+}
+
+//ORDER BY - the listed columns are packed into one integer key, first column in the top bits, and sel is radix sorted on it
+#define MAX_SORT_KEYS 4
+#define RADIX_BITS 8
+//Other half of the radix sort's ping-pong with sel, or the heap top_k keeps its best rows in
+static union {
+    uint16_t rows[ARRAY_SIZE];
+    uint64_t heap[ARRAY_SIZE / 4];
+} sort_buf;
+#define TOPK_MAX (ARRAY_SIZE / 4)   // Most rows top_k can keep
+#define TOPK_KEY_BITS 48            // Widest packed key top_k can take - the low 16 bits of a heap entry are the row's place in sel
+
+//Bits a column takes up in the packed key - each one less than 64, so sort_key never shifts a whole uint64_t
+#define KEY_WIDTH_CHECK(ID, name, storage, key_bits, field, sample, dump_label) \
+    _Static_assert((key_bits) < 64, #name " is too wide for the packed sort key");
+TABLE_COLUMNS(KEY_WIDTH_CHECK)
+#define KEY_WIDTH_CASE(ID, name, storage, key_bits, field, sample, dump_label) case COL_##ID: return key_bits;
+int key_width(int col){
+    switch(col){
+        TABLE_COLUMNS(KEY_WIDTH_CASE)
+    }
+    return 0;
+}
+
+//Bits the packed key of these columns takes up
+int key_bits(const int *keys, int num_keys){
+    int bits = 0;
+    for(int k = 0; k < num_keys; k++){
+        bits += key_width(keys[k]);
+    }
+    return bits;
+}
+
+//ORDER BY ... DESC - every bit of the packed key flipped, so sorting it smallest first puts the largest rows first
+static inline uint64_t key_flip(int bits, bool desc){
+    if(!desc){
+        return 0;
+    }
+    return (bits >= 64) ? ~0ull : (1ull << bits) - 1;
+}
+
+//Pack the sort columns of one row
+static inline uint64_t sort_key(const int *keys, int num_keys, int row){
+    uint64_t key = 0;
+    for(int k = 0; k < num_keys; k++){
+        key = (key << key_width(keys[k])) | column_value(keys[k], row);
+    }
+    return key;
+}
+
+//The bits of one sort column that land in a radix digit - at most MAX_SORT_KEYS of them, when narrow columns share a digit
+struct DigitPart {
+    int col;
+    int down;           // Column bits below the digit
+    uint32_t mask;      // Column bits in the digit, once shifted down
+    int up;             // Where they go in the digit
+};
+
+//Work out which columns feed the digit at bit shift of the packed key - the last key column is the lowest bits
+int digit_parts(const int *keys, int num_keys, int shift, struct DigitPart *parts){
+    int num_parts = 0;
+    int low = 0;
+    for(int k = num_keys - 1; k >= 0; k--){
+        int width = key_width(keys[k]);
+        int from = (shift > low) ? shift : low;
+        int to = (shift + RADIX_BITS < low + width) ? shift + RADIX_BITS : low + width;
+        if(from < to){
+            parts[num_parts].col = keys[k];
+            parts[num_parts].down = from - low;
+            parts[num_parts].mask = (1u << (to - from)) - 1;
+            parts[num_parts].up = from - shift;
+            num_parts ++;
+        }
+        low += width;
+    }
+    return num_parts;
+}
+
+//One row's radix digit, read straight out of the columns it comes from
+static inline uint32_t radix_digit(const struct DigitPart *parts, int num_parts, uint32_t flip, int row){
+    uint32_t digit = flip;
+    for(int p = 0; p < num_parts; p++){
+        digit ^= ((column_value(parts[p].col, row) >> parts[p].down) & parts[p].mask) << parts[p].up;
+    }
+    return digit;
+}
+
+//Stable LSD radix sort of sel[0..count) on the packed key, RADIX_BITS per pass - largest first with desc
+//Passes where every row has the same digit (the high bits of the timestamps, usually) are skipped
+//Each pass reads its digit from the one or two columns under it rather than packing the whole key, so no key is stored and
+//the sort needs no more than the row buffer it ping-pongs with
+void radix_sort(const int *keys, int num_keys, bool desc, int count){
+    int bits = key_bits(keys, num_keys);
+    uint64_t flip = key_flip(bits, desc);
+    uint16_t *src = sel;
+    uint16_t *dst = sort_buf.rows;
+    struct DigitPart parts[MAX_SORT_KEYS];
+    for(int shift = 0; shift < bits; shift += RADIX_BITS){
+        int num_parts = digit_parts(keys, num_keys, shift, parts);
+        uint32_t flip_digit = (flip >> shift) & ((1 << RADIX_BITS) - 1);
+        uint16_t offsets[1 << RADIX_BITS];
+        for(int d = 0; d < (1 << RADIX_BITS); d++){
+            offsets[d] = 0;
+        }
+        for(int i = 0; i < count; i++){
+            offsets[radix_digit(parts, num_parts, flip_digit, src[i])]++;
+        }
+        bool one_digit = false;
+        uint16_t total = 0;
+        for(int d = 0; d < (1 << RADIX_BITS); d++){
+            uint16_t digits = offsets[d];
+            one_digit |= (digits == count);
+            offsets[d] = total;
+            total += digits;
+        }
+        if(one_digit){
+            continue;
+        }
+        for(int i = 0; i < count; i++){
+            dst[offsets[radix_digit(parts, num_parts, flip_digit, src[i])]++] = src[i];
+        }
+        uint16_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if(src != sel){
+        for(int i = 0; i < count; i++){
+            sel[i] = src[i];
+        }
+    }
+}
+
+//Max-heap of top_k's entries - move heap[i] down until neither child is bigger
+static inline void heap_down(uint64_t *heap, int n, int i){
+    while(true){
+        int big = i;
+        int left = 2 * i + 1;
+        if((left < n) && (heap[left] > heap[big])){
+            big = left;
+        }
+        if((left + 1 < n) && (heap[left + 1] > heap[big])){
+            big = left + 1;
+        }
+        if(big == i){
+            return;
+        }
+        uint64_t tmp = heap[i];
+        heap[i] = heap[big];
+        heap[big] = tmp;
+        i = big;
+    }
+}
+
+//ORDER BY ... LIMIT - only the first k rows of the order are wanted, so instead of sorting all of sel keep the k smallest
+//keys seen so far in a max-heap, each new row only going in if it beats the largest: O(count log k), and then only those
+//k get sorted. A heap entry is the packed key with the row's place in sel in the low 16 bits, so equal keys come out in the
+//order they went in, the same as the radix sort
+//Leaves the first k rows in order in sel[0..k) - k has to be at most TOPK_MAX and the key at most TOPK_KEY_BITS wide
+int top_k(const int *keys, int num_keys, bool desc, int count, int k){
+    uint64_t flip = key_flip(key_bits(keys, num_keys), desc);
+    uint64_t *heap = sort_buf.heap;
+    int n = 0;
+    for(int i = 0; i < count; i++){
+        uint64_t entry = ((sort_key(keys, num_keys, sel[i]) ^ flip) << 16) | i;
+        if(n < k){
+            //Not full yet - in at the bottom and up past every smaller parent
+            int c = n++;
+            while((c > 0) && (heap[(c - 1) / 2] < entry)){
+                heap[c] = heap[(c - 1) / 2];
+                c = (c - 1) / 2;
+            }
+            heap[c] = entry;
+        }
+        else if(entry < heap[0]){
+            heap[0] = entry;
+            heap_down(heap, n, 0);
+        }
+    }
+    //Heap sort what is left - the largest goes to the back each time
+    for(int last = n - 1; last > 0; last--){
+        uint64_t tmp = heap[0];
+        heap[0] = heap[last];
+        heap[last] = tmp;
+        heap_down(heap, last, 0);
+    }
+    //Row ids out of their places in sel - through the heap, since sel gets overwritten as it goes
+    for(int i = 0; i < n; i++){
+        heap[i] = sel[heap[i] & 0xFFFF];
+    }
+    for(int i = 0; i < n; i++){
+        sel[i] = heap[i];
+    }
+    return n;
+}
+
+//Text rows go out through a TX buffer straight to the USB driver instead of printf - printf puts a \r in front of every \n
+//when CRLF translation is on, so rows written past it do the same to come out byte for byte as they always have
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT && PICO_STDIO_DEFAULT_CRLF
+#define TX_NEWLINE "\r\n"
+#else
+#define TX_NEWLINE "\n"
+#endif
+static struct TxBuf tx;
+
+//Room in TinyUSB's CDC FIFO - that much can go to the driver without it waiting on the host
+uint32_t tx_room(){
+    return tud_cdc_write_available();
+}
+void tx_write(const char *buf, int len){
+    stdio_usb.out_chars(buf, len);
+}
+
+//Binary results - opt-in with DUMPB or a trailing FORMAT BINARY on a SELECT, decoded by Pi_code/result_decoder.py
+//Frame: 'M' 'D' | type | payload length (u16) | payload | CRC-16/XMODEM over type, length and payload (u16), all little-endian
+//A result is one header frame, then for every block of up to FRAME_BLOCK_ROWS rows one column frame per selected column, then an end frame
+#define FRAME_HEADER 'H'        // u32 row count, u8 column mask (time 8, potv 4, butp 2, ledo 1), u32 timestamp
+#define FRAME_COLUMN 'C'        // u8 column mask bit, u16 row count, values - time u32, potv u16, butp/ledo packed 8 rows a byte
+#define FRAME_END 'E'           // u32 microseconds spent sending
+#define FRAME_BLOCK_ROWS 256
+#define FRAME_OVERHEAD 7        // sync, type, length and CRC
+static uint8_t frame_buf[FRAME_OVERHEAD + 3 + FRAME_BLOCK_ROWS * 4];
+
+static inline uint8_t *put_u16(uint8_t *p, uint16_t v){
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+    return p + 2;
+}
+static inline uint8_t *put_u32(uint8_t *p, uint32_t v){
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+//Wrap the payload already sitting at frame_buf + 5 and write it out - straight to the USB driver so nothing gets CRLF translated
+void send_frame(uint8_t type, int payload_len){
+    tx_flush(&tx);
+    frame_buf[0] = 'M';
+    frame_buf[1] = 'D';
+    frame_buf[2] = type;
+    put_u16(frame_buf + 3, payload_len);
+    put_u16(frame_buf + 5 + payload_len, crc16(frame_buf + 2, 3 + payload_len));
+    stdio_usb.out_chars((const char*) frame_buf, payload_len + FRAME_OVERHEAD);
+}
+
+//Binary result header - sent when a result starts
+void send_binary_header(int count, int mask, uint32_t start){
+    uint8_t *p = frame_buf + 5;
+    p = put_u32(p, count);
+    *p++ = mask;
+    p = put_u32(p, start);
+    send_frame(FRAME_HEADER, p - (frame_buf + 5));
+}
+
+//Column frame values by storage kind - U32 as u32, U16 as u16, BIT packed 8 rows a byte
+#define FRAME_VALUES_U32(col, field) \
+    for(int k = 0; k < rows; k++){ \
+        p = put_u32(p, SNAP_LOAD(U32, col, field, block[k])); \
+    }
+#define FRAME_VALUES_U16(col, field) \
+    for(int k = 0; k < rows; k++){ \
+        p = put_u16(p, SNAP_LOAD(U16, col, field, block[k])); \
+    }
+#define FRAME_VALUES_BIT(col, field) \
+    for(int k = 0; k < rows; k += 8){ \
+        uint8_t packed = 0; \
+        for(int j = 0; (j < 8) && (k + j < rows); j++){ \
+            packed |= SNAP_LOAD(BIT, col, field, block[k + j]) << j; \
+        } \
+        *p++ = packed; \
+    }
+#define FRAME_CASE(ID, name, storage, key_bits, field, sample, dump_label) case COL_##ID: FRAME_VALUES_##storage(name##_col, field) break;
+
+//One column frame per bit set in mask for the rows in sel[base..base + rows), as they were when the result started
+void send_binary_block(int base, int rows, int mask){
+    const uint16_t *block = sel + base;
+    for(int col = 0; col < NUM_COLS; col++){
+        if(!(mask & COL_BIT(col))){
+            continue;
+        }
+        uint8_t *p = frame_buf + 5;
+        *p++ = COL_BIT(col);
+        p = put_u16(p, rows);
+        switch(col){
+            TABLE_COLUMNS(FRAME_CASE)
+        }
+        send_frame(FRAME_COLUMN, p - (frame_buf + 5));
+    }
+}
+
+//Binary result trailer
+void send_binary_end(uint32_t start){
+    uint8_t *p = put_u32(frame_buf + 5, time_us_32() - start);
+    send_frame(FRAME_END, p - (frame_buf + 5));
+}
+
+//Text projection - header line and one row for the columns in a select mask
+void print_select_header(int select){
+    bool first = true;
+    for(int col = 0; col < NUM_COLS; col++){
+        if(select & COL_BIT(col)){
+            printf(first ? "%s" : ", %s", column_name(col));
+            first = false;
+        }
+    }
+    printf("\n");
+}
+char *fmt_select_row(char *p, int select, int row){
+    bool first = true;
+    for(int col = 0; col < NUM_COLS; col++){
+        if(select & COL_BIT(col)){
+            p = fmt_str(p, first ? "" : ", ");
+            p = fmt_u32(p, column_value(col, row));
+            first = false;
+        }
+    }
+    return p;
+}
+void print_select_row(int select, int row){
+    tx_end(&tx, fmt_str(fmt_select_row(tx_begin(&tx), select, row), TX_NEWLINE));
+}
+void print_point_row(int select, struct DataPoint point){
+    char *p = tx_begin(&tx);
+    bool first = true;
+    for(int col = 0; col < NUM_COLS; col++){
+        if(select & COL_BIT(col)){
+            p = fmt_str(p, first ? "" : ", ");
+            p = fmt_u32(p, point_value(col, point));
+            first = false;
+        }
+    }
+    tx_end(&tx, fmt_str(p, TX_NEWLINE));
+}
+
+//Aggregates - SELECT COUNT(*),AVG(potv) ... GROUP BY butp answers with one row per group instead of every matching row
+//Rows reach the cursor sorted on the group column, so a group is one contiguous run of sel and only its running values are kept
+#define MAX_AGGS 4
+#define AGG_COUNT 1
+#define AGG_MIN 2
+#define AGG_MAX 3
+#define AGG_SUM 4
+#define AGG_AVG 5
+#define AGG_PERCENTILE 6        // PERCENTILE(potv, fraction) - only ever answered from potv_hist
+#define AGG_HISTOGRAM 7         // HISTOGRAM(potv, width) - the same, and a row per non-empty bin instead of one row
+struct AggSpec {
+    int count;                  // Aggregates in the select list, 0 for a plain SELECT
+    int funcs[MAX_AGGS];        // AGG_*
+    int cols[MAX_AGGS];         // COL_*, COL_NONE for COUNT(*)
+    uint32_t params[MAX_AGGS];  // The number after the column - a PERCENTILE's fraction in millionths, a HISTOGRAM's bin width
+    int group_col;              // GROUP BY column, COL_NONE for one group over every row
+    uint32_t group_width;       // Bucket width - GROUP BY time/1000000 is one group per second
+};
+struct AggState {
+    uint32_t rows;
+    uint64_t sum[MAX_AGGS];
+    uint32_t min[MAX_AGGS];
+    uint32_t max[MAX_AGGS];
 };
 
-/*
-TODO:
-1. Final topology out of options: Pi side
-2. Epochs: determined experimentally, but pico needs a window to send and receive data: solved here and Pi side
-3. Table: DataPoint Struct - solved here mostly but needs stuff on Pi side to make it better maybe - maybe determine max memory footprint here?
-    3.1. Kick out data: store variable and index to kick out data with lowest deltas to replace with most current data (potentiometer value) - find out how much time's worth of data can be stored on the pico before the table fills up
-4. SQL Logic: Unsolved - dissect message into SELECT, WHERE, and ORDER BY and then do table shenanigans
-5. Parameters: Unsolved - Pi level vs Pico level query processing - epochs
-*/
+//Aggregate from the first letters of its name - COUNT, MIN, MAX, SUM, AVG, PERCENTILE, HISTOGRAM
+int agg_func(const char *name){
+    if(name[0] == 'C') return AGG_COUNT;
+    if(name[0] == 'P') return AGG_PERCENTILE;
+    if(name[0] == 'H') return AGG_HISTOGRAM;
+    if(name[0] == 'S') return AGG_SUM;
+    if(name[0] == 'A') return AGG_AVG;
+    if(name[0] == 'M') return (name[1] == 'I') ? AGG_MIN : AGG_MAX;
+    return 0;
+}
+
+//Group a row falls in - its bucket number, not the value the bucket starts at
+static inline uint32_t agg_group(const struct AggSpec *spec, int row){
+    if(spec->group_col == COL_NONE){
+        return 0;
+    }
+    return column_value(spec->group_col, row) / spec->group_width;
+}
+
+static inline uint32_t agg_group_point(const struct AggSpec *spec, struct DataPoint point){
+    if(spec->group_col == COL_NONE){
+        return 0;
+    }
+    return point_value(spec->group_col, point) / spec->group_width;
+}
+
+void agg_reset(struct AggState *acc){
+    acc->rows = 0;
+    for(int a = 0; a < MAX_AGGS; a++){
+        acc->sum[a] = 0;
+        acc->min[a] = UINT32_MAX;
+        acc->max[a] = 0;
+    }
+}
+
+void agg_add(const struct AggSpec *spec, struct AggState *acc, int row){
+    acc->rows++;
+    for(int a = 0; a < spec->count; a++){
+        if(spec->cols[a] == COL_NONE){
+            continue;
+        }
+        uint32_t x = column_value(spec->cols[a], row);
+        acc->sum[a] += x;
+        if(x < acc->min[a]) acc->min[a] = x;
+        if(x > acc->max[a]) acc->max[a] = x;
+    }
+}
+
+//Same for a row that is not in the table
+void agg_add_point(const struct AggSpec *spec, struct AggState *acc, struct DataPoint point){
+    acc->rows++;
+    for(int a = 0; a < spec->count; a++){
+        if(spec->cols[a] == COL_NONE){
+            continue;
+        }
+        uint32_t x = point_value(spec->cols[a], point);
+        acc->sum[a] += x;
+        if(x < acc->min[a]) acc->min[a] = x;
+        if(x > acc->max[a]) acc->max[a] = x;
+    }
+}
+
+void print_agg_header(const struct AggSpec *spec){
+    if(spec->group_col != COL_NONE){
+        printf("%s, ", column_name(spec->group_col));
+    }
+    //A HISTOGRAM reads like COUNT(*) GROUP BY potv/width
+    if(spec->funcs[0] == AGG_HISTOGRAM){
+        printf("potv, count(*)\n");
+        return;
+    }
+    for(int a = 0; a < spec->count; a++){
+        const char *names[] = {"", "count", "min", "max", "sum", "avg", "percentile"};
+        printf("%s(%s", names[spec->funcs[a]], column_name(spec->cols[a]));
+        if(spec->funcs[a] == AGG_PERCENTILE){
+            //The fraction as it was asked for, less any trailing zeros
+            uint32_t frac = spec->params[a] % HIST_ONE;
+            int digits = 6;
+            while((frac > 0) && (frac % 10 == 0)){
+                frac /= 10;
+                digits --;
+            }
+            printf(",%u", spec->params[a] / HIST_ONE);
+            if(frac > 0){
+                printf(".%0*u", digits, frac);
+            }
+        }
+        printf(")");
+        if(a < spec->count - 1){
+            printf(", ");
+        }
+    }
+    printf("\n");
+}
+
+//One result row - the group column shows the value its bucket starts at, averages have two decimals
+//MIN, MAX, SUM, AVG and PERCENTILE of no rows are NULL, which only an ungrouped query over nothing can hit
+char *fmt_agg_row(char *p, const struct AggSpec *spec, const struct AggState *acc, uint32_t group){
+    if(spec->group_col != COL_NONE){
+        p = fmt_str(fmt_u32(p, group * spec->group_width), ", ");
+    }
+    for(int a = 0; a < spec->count; a++){
+        if(spec->funcs[a] == AGG_COUNT){
+            p = fmt_u32(p, acc->rows);
+        }
+        else if(acc->rows == 0){
+            p = fmt_str(p, "NULL");
+        }
+        else if(spec->funcs[a] == AGG_MIN){
+            p = fmt_u32(p, acc->min[a]);
+        }
+        else if(spec->funcs[a] == AGG_MAX){
+            p = fmt_u32(p, acc->max[a]);
+        }
+        else if(spec->funcs[a] == AGG_SUM){
+            p = fmt_u64(p, acc->sum[a]);
+        }
+        else if(spec->funcs[a] == AGG_PERCENTILE){
+            p = fmt_u32(p, hist_percentile(&potv_hist, spec->params[a]));
+        }
+        else{
+            uint64_t avg = (acc->sum[a] * 100 + acc->rows / 2) / acc->rows;
+            p = fmt_u64(p, avg / 100);
+            *p++ = '.';
+            *p++ = '0' + (avg % 100) / 10;
+            *p++ = '0' + avg % 10;
+        }
+        if(a < spec->count - 1){
+            p = fmt_str(p, ", ");
+        }
+    }
+    return p;
+}
+void print_agg_row(const struct AggSpec *spec, const struct AggState *acc, uint32_t group){
+    tx_end(&tx, fmt_str(fmt_agg_row(tx_begin(&tx), spec, acc, group), TX_NEWLINE));
+}
+
+//PERCENTILE and HISTOGRAM are answered from potv_hist without looking at a row, and so is anything else in the list with
+//them - which means they only go with COUNT(*) and other potv aggregates, and HISTOGRAM only on its own
+bool agg_uses_hist(const struct AggSpec *spec){
+    for(int a = 0; a < spec->count; a++){
+        if(spec->funcs[a] >= AGG_PERCENTILE){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool agg_hist_only(const struct AggSpec *spec){
+    for(int a = 0; a < spec->count; a++){
+        if(((spec->cols[a] != COL_POTV) && (spec->cols[a] != COL_NONE)) || ((spec->funcs[a] == AGG_HISTOGRAM) && (spec->count > 1))){
+            return false;
+        }
+    }
+    return true;
+}
+
+//COUNT, MIN, MAX, SUM and AVG of potv over the whole table, out of the potv index - PERCENTILE is read when the row goes out
+void agg_from_hist(const struct AggSpec *spec, struct AggState *acc){
+    agg_reset(acc);
+    acc->rows = potv_hist.count;
+    if(acc->rows == 0){
+        return;
+    }
+    for(int a = 0; a < spec->count; a++){
+        acc->sum[a] = potv_sum;
+        acc->min[a] = potv_used_above(0);
+        acc->max[a] = potv_used_below(ADC_LEVELS - 1);
+    }
+}
+
+//STATS - per phase timings kept all the time, printed on request
+static struct Stats stats;
+
+#if PICO_ON_DEVICE
+//Core0's stack is painted at boot, and the deepest word that has lost the paint is how far it has ever reached
+#define STACK_PAINT 0x5AC5AC5Au
+extern uint32_t __StackBottom, __StackTop;
+extern char __data_start__, __bss_end__, end;
+
+void stack_paint(){
+    uint32_t here;
+    //Leave the words just below this frame alone, the paint loop itself is using them
+    for(uint32_t *word = &__StackBottom; word < &here - 16; word++){
+        *word = STACK_PAINT;
+    }
+}
+
+void print_memory(){
+    uint32_t *word = &__StackBottom;
+    while((word < &__StackTop) && (*word == STACK_PAINT)){
+        word ++;
+    }
+    printf("Stack peak: %d of %d bytes\nStatic RAM: %d bytes\nHeap: %d bytes\n", (int)((char*) &__StackTop - (char*) word),
+           (int)((char*) &__StackTop - (char*) &__StackBottom), (int)(&__bss_end__ - &__data_start__), (int)((char*) sbrk(0) - &end));
+}
+#else
+//Nowhere fixed to paint off the Pico
+void stack_paint(){}
+void print_memory(){
+    printf("Stack peak: not measured on this platform\n");
+}
+#endif
+
+void stats_reset(){
+    stats = (struct Stats){0};
+    stats.since = time_us_32();
+}
+
+void print_stats(){
+    static const char *names[NUM_STATS] = {"serial", "parse", "filter", "sort", "output", "ingest", "evict", "loop", "query"};
+    printf("Stats over %u us\nphase\tcount\ttotal_us\tavg_us\tmax_us\thistogram (0, <2, <4, <8 ... us)\n", time_us_32() - stats.since);
+    for(int p = 0; p < NUM_STATS; p++){
+        const struct StatHist *hist = &stats.phase[p];
+        printf("%s\t%u\t%llu\t%llu\t%u\t", names[p], hist->count, (unsigned long long) hist->total,
+               (unsigned long long)(hist->count ? hist->total / hist->count : 0), hist->max);
+        //Up to the last bucket anything landed in
+        int last = STAT_BUCKETS - 1;
+        while((last > 0) && (hist->buckets[last] == 0)){
+            last --;
+        }
+        for(int b = 0; b <= last; b++){
+            printf((b < last) ? "%u " : "%u\n", hist->buckets[b]);
+        }
+    }
+    printf("Loop overruns: %u\nRows scanned: %llu\nRows returned: %llu\n", stats.overruns,
+           (unsigned long long) stats.rows_scanned, (unsigned long long) stats.rows_returned);
+    printf("Snapshot rows copied: %u\nSnapshots too old: %u\n", stats.snap_rows, stats.snaps_too_old);
+    print_memory();
+}
+
+//History outside the table - every sample the table takes is appended to the flash log and the compressed blocks too,
+//and SELECT ... FROM FLASH or FROM BLOCKS scans them. Pages and blocks carry the ranges of their rows, so a scan only
+//decodes the ones the WHERE clause could match
+static struct FlashDev flash_dev;
+static struct FlashLog flash_log;
+static struct TsBlock ts_blocks[TS_BLOCKS > 0 ? TS_BLOCKS : 1];
+static struct TsStore ts_store;
+
+//Where a query reads its rows from
+#define SOURCE_TABLE 0
+#define SOURCE_FLASH 1
+#define SOURCE_BLOCKS 2
+
+//Whether any row of a page or block can pass a WHERE clause, going by its summary
+#define SUMMARY_MATCH_U32(ID, name) range_match(op, summary->name##_min, summary->name##_max, val)
+#define SUMMARY_MATCH_U16(ID, name) range_match(op, summary->name##_min, summary->name##_max, val)
+#define SUMMARY_MATCH_BIT(ID, name) \
+    range_match(op, (summary->seen & SEEN_ZERO(SEEN_SLOT_##ID)) ? 0 : 1, (summary->seen & SEEN_ONE(SEEN_SLOT_##ID)) ? 1 : 0, val)
+#define SUMMARY_MATCH_CASE(ID, name, storage, key_bits, field, sample, dump_label) \
+    case COL_##ID: return SUMMARY_MATCH_##storage(ID, name);
+bool summary_may_match(const struct RowSummary *summary, int col, int op, uint32_t val){
+    switch(col){
+        TABLE_COLUMNS(SUMMARY_MATCH_CASE)
+    }
+    return true;
+}
+
+//Compiled query - everything the executor needs, worked out from the SQL text once by compile_query
+//PREPARE keeps one in the plan cache so EXEC can run it again without the text being sent or lexed
+struct QueryPlan {
+    int select;                     // Column mask - COL_BIT of every projected column
+    int where_col;                  // COL_NONE for no WHERE clause
+    int where_op;                   // OP_*
+    uint32_t where_val;
+    bool where_param;               // The WHERE value was a ?, to be filled in by EXEC
+    int order_count;
+    int order_cols[MAX_SORT_KEYS];  // COL_* in the order they were listed
+    bool order_desc;                // DESC - largest first on every ORDER BY column
+    int limit;                      // LIMIT - rows to send at most, -1 for all of them
+    int offset;                     // OFFSET - rows of the order to leave out before those
+    bool binary;                    // FORMAT BINARY
+    int source;                     // SOURCE_* - FROM FLASH or FROM BLOCKS, the table otherwise
+    uint32_t epoch;                 // EPOCH in ms - 0 runs the query once, anything else makes it a standing query
+    struct AggSpec agg;             // agg.count 0 for a plain SELECT
+};
+
+//Query cursor - a DUMP or SELECT result in sel that goes out a slice per loop so sampling keeps its MS_BT_LOOP cadence
+//Only one result is in flight at a time - commands wait in the RX queue behind it, and PAUSE, STOP or CANCEL cut it off
+#define CURSOR_IDLE 0
+#define CURSOR_DUMP 1
+#define CURSOR_SELECT 2
+#define CURSOR_AGG 3
+#define CURSOR_HIST 4   // Reads potv_hist instead of sel - count and pos are HISTOGRAM bins, count is 0 for one row of PERCENTILEs
+#define CURSOR_FLASH 5  // Walks flash log pages instead of sel - count and pos are pages
+#define CURSOR_BLOCKS 6 // Walks compressed blocks instead of sel - count and pos are blocks
+struct QueryCursor {
+    int kind;           // CURSOR_* - what the text preamble and trailer look like
+    bool binary;        // Frames instead of text
+    int select;         // Column mask
+    int count;          // Rows in sel
+    int pos;            // Next row of sel to send
+    uint32_t start;     // When the query came in, for the trailer
+    struct AggSpec agg;     // CURSOR_AGG and CURSOR_HIST, and scans when agg.count > 0 - what to compute
+    struct AggState acc;    // Running values of the group being read
+    uint32_t group;         // Which group that is
+    int where_col;              // Scans only (CURSOR_FLASH and CURSOR_BLOCKS) - the WHERE clause, checked row by row
+    int where_op;
+    uint32_t where_val;
+    uint32_t first;             // Scans only - block number pos 0 is, for CURSOR_BLOCKS
+    int row;                    // Scans only - next row of the page or block, 0 when it has not been read yet
+    int skipped;                // Scans only - pages or blocks the summaries ruled out
+    int offset;                 // Scans only - matching rows still to leave out for OFFSET
+    int limit;                  // Scans only - rows still to send for LIMIT, -1 for no limit
+    struct FlashLogPage page;   // CURSOR_FLASH only - the page being read
+    struct TsBlock block;       // CURSOR_BLOCKS only - the block being read, and where it is up to
+    struct TsReader reader;
+};
+static struct QueryCursor cursor = {CURSOR_IDLE};
+//Standing query rows that came up while a result was going out - they wait here until it has finished, so none land in
+//the middle of its rows or frames
+static struct TxHold standing_hold;
+
+void cursor_close(){
+    tx_flush(&tx);
+    stats.snap_rows += snap_count;
+    snap_release();
+    hist_release();
+    stat_add(&stats.phase[STAT_QUERY], time_us_32() - cursor.start);
+    if(cursor.binary){
+        send_binary_end(cursor.start);
+    }
+    else if(cursor.kind == CURSOR_DUMP){
+        printf("Time to print %u\n", time_us_32() - cursor.start);
+    }
+    else if(cursor.kind >= CURSOR_FLASH){
+        printf("Skipped %d of %d %s\nTime to query: %u\n", cursor.skipped, cursor.count,
+               (cursor.kind == CURSOR_FLASH) ? "pages" : "blocks", time_us_32() - cursor.start);
+    }
+    else{
+        printf("Time to query: %u\n", time_us_32() - cursor.start);
+    }
+    cursor.kind = CURSOR_IDLE;
+    //Then the standing rows held back behind it, and how many did not fit
+    tx_hold_release(&tx, &standing_hold);
+    if(standing_hold.dropped > 0){
+        char *p = fmt_u32(fmt_str(tx_begin(&tx), "Standing rows dropped: "), standing_hold.dropped);
+        tx_end(&tx, fmt_str(p, TX_NEWLINE));
+        standing_hold.dropped = 0;
+    }
+}
+
+//Cut off the result in flight - PAUSE, STOP or CANCEL has come in, and the user does not want the rest of the rows
+//Binary results just end early, their header already said how many rows to expect
+void cursor_cancel(){
+    if(cursor.kind == CURSOR_IDLE){
+        return;
+    }
+    tx_flush(&tx);
+    if(!cursor.binary){
+        printf("Cancelled after %d of %d %s\n", cursor.pos, cursor.count,
+               (cursor.kind == CURSOR_FLASH) ? "pages" : (cursor.kind == CURSOR_BLOCKS) ? "blocks" : "rows");
+    }
+    cursor_close();
+}
+
+//Start sending sel[0..count) - only the preamble goes out now, rows go out in cursor_step
+//agg is only looked at for CURSOR_AGG, which is always text
+void cursor_open(int kind, bool binary, int select, int count, uint32_t start, const struct AggSpec *agg){
+    tx_flush(&tx);
+    cursor_cancel();
+    cursor.kind = kind;
+    cursor.binary = binary;
+    //Results out of sel read the table as it is now until they finish, however long that takes
+    snap_open = (kind == CURSOR_DUMP) || (kind == CURSOR_SELECT) || (kind == CURSOR_AGG);
+    hist_hold = (kind == CURSOR_HIST);
+    cursor.select = select;
+    cursor.count = count;
+    cursor.pos = 0;
+    cursor.start = start;
+    if(binary){
+        send_binary_header(count, select, start);
+    }
+    else if(kind == CURSOR_DUMP){
+        printf("Dumping %d lines\nTime: %u\n", count, start);
+    }
+    else if(kind == CURSOR_AGG){
+        cursor.agg = *agg;
+        agg_reset(&cursor.acc);
+        printf("Aggregating over array size %d\n", count);
+        print_agg_header(agg);
+    }
+    else if(kind == CURSOR_HIST){
+        cursor.agg = *agg;
+        agg_from_hist(agg, &cursor.acc);
+        printf("Aggregating over array size %u\n", potv_hist.count);
+        print_agg_header(agg);
+    }
+    else if(kind >= CURSOR_FLASH){
+        cursor.row = 0;
+        cursor.skipped = 0;
+        cursor.agg.count = 0;
+        printf("Scanning %d %s\n", count, (kind == CURSOR_FLASH) ? "flash pages" : "blocks");
+        if(agg != NULL){
+            cursor.agg = *agg;
+            agg_reset(&cursor.acc);
+            print_agg_header(agg);
+        }
+        else{
+            print_select_header(select);
+        }
+    }
+    else{
+        printf("Projecting over array size %d\n", count);
+        print_select_header(select);
+    }
+}
+
+//Ingest needed the overlay and it was full - the result in flight can no longer be kept consistent, so it ends here
+void cursor_too_old(){
+    tx_flush(&tx);
+    if(!cursor.binary){
+        printf("Snapshot too old after %d of %d rows\n", cursor.pos, cursor.count);
+    }
+    stats.snaps_too_old ++;
+    cursor_close();
+}
+
+//Aggregate results come out a group at a time - a row from the next group finishes the one before it
+static inline void cursor_group(uint32_t group){
+    if((cursor.acc.rows > 0) && (group != cursor.group)){
+        print_agg_row(&cursor.agg, &cursor.acc, cursor.group);
+        agg_reset(&cursor.acc);
+    }
+    cursor.group = group;
+}
+
+//Scans - the next row of the page or block at pos, reading it first if it has not been yet
+//Returns false without a row when the page or block was skipped, having moved pos on past it
+bool scan_next(struct DataPoint *point){
+    int rows;
+    if(cursor.kind == CURSOR_FLASH){
+        //Start of a page - its header decides whether the rows are worth reading
+        struct FlashPageHeader header;
+        if((cursor.row == 0) && (!flash_log_header(&flash_log, cursor.pos, &header) ||
+            !summary_may_match(&header.summary, cursor.where_col, cursor.where_op, cursor.where_val) ||
+            !flash_log_read(&flash_log, cursor.pos, &cursor.page))){
+            cursor.skipped ++;
+            cursor.pos ++;
+            return false;
+        }
+        *point = flash_page_row(&cursor.page, cursor.row);
+        rows = cursor.page.header.count;
+    }
+    else{
+        //Blocks are copied out whole, since the ring can start reusing this one before the scan is done with it
+        if(cursor.row == 0){
+            if(!ts_store_get(&ts_store, cursor.first + cursor.pos, &cursor.block) ||
+                !summary_may_match(&cursor.block.header.summary, cursor.where_col, cursor.where_op, cursor.where_val)){
+                cursor.skipped ++;
+                cursor.pos ++;
+                return false;
+            }
+            ts_reader_init(&cursor.reader, &cursor.block);
+        }
+        *point = ts_reader_next(&cursor.reader);
+        rows = cursor.block.header.count;
+    }
+    cursor.row ++;
+    if(cursor.row == rows){
+        cursor.row = 0;
+        cursor.pos ++;
+    }
+    return true;
+}
+
+//One column of a DUMP line
+#define DUMP_FIELD(ID, name, storage, key_bits, field, sample, dump_label) p = fmt_u32(fmt_str(p, dump_label), point.field);
+
+//Send rows until the result is done or time_us_32() passes deadline - at least one row or block goes out per call
+void cursor_step(uint32_t deadline){
+    while(cursor.pos < cursor.count){
+        if(cursor.binary){
+            int rows = (cursor.count - cursor.pos < FRAME_BLOCK_ROWS) ? cursor.count - cursor.pos : FRAME_BLOCK_ROWS;
+            send_binary_block(cursor.pos, rows, cursor.select);
+            cursor.pos += rows;
+        }
+        else if(cursor.kind == CURSOR_DUMP){
+            int i = sel[cursor.pos++];
+            struct DataPoint point = snap_get_row(i);
+            char *p = fmt_u32(fmt_str(tx_begin(&tx), "Index: "), i);
+            TABLE_COLUMNS(DUMP_FIELD)
+            tx_end(&tx, fmt_str(p, TX_NEWLINE));
+        }
+        else if(cursor.kind == CURSOR_AGG){
+            //Rows ingest has overwritten since the result started come out of the snapshot overlay instead
+            int i = sel[cursor.pos++];
+            if(snap_dirty_row(i)){
+                struct DataPoint point = snap_get_row(i);
+                cursor_group(agg_group_point(&cursor.agg, point));
+                agg_add_point(&cursor.agg, &cursor.acc, point);
+            }
+            else{
+                cursor_group(agg_group(&cursor.agg, i));
+                agg_add(&cursor.agg, &cursor.acc, i);
+            }
+        }
+        else if(cursor.kind == CURSOR_HIST){
+            //One HISTOGRAM bin - empty ones are left out
+            uint32_t width = cursor.agg.params[0];
+            uint32_t v = cursor.pos++ * width;
+            uint32_t rows = hist_range(&potv_hist, v, width);
+            if(rows > 0){
+                char *p = fmt_str(fmt_u32(tx_begin(&tx), v), ", ");
+                tx_end(&tx, fmt_str(fmt_u32(p, rows), TX_NEWLINE));
+            }
+        }
+        else if(cursor.kind >= CURSOR_FLASH){
+            //Rows are decoded one at a time and the WHERE clause checked on each
+            struct DataPoint point;
+            bool decoded = scan_next(&point);
+            stats.rows_scanned += decoded;
+            if(decoded && ((cursor.where_col == COL_NONE) || op_match(cursor.where_op, point_value(cursor.where_col, point), cursor.where_val))){
+                stats.rows_returned ++;
+                if(cursor.agg.count > 0){
+                    cursor_group(agg_group_point(&cursor.agg, point));
+                    agg_add_point(&cursor.agg, &cursor.acc, point);
+                }
+                else if(cursor.offset > 0){
+                    cursor.offset --;
+                }
+                else{
+                    print_point_row(cursor.select, point);
+                    //LIMIT reached - nothing after this row needs decoding
+                    if(--cursor.limit == 0){
+                        cursor.pos = cursor.count;
+                    }
+                }
+            }
+        }
+        else{
+            int i = sel[cursor.pos++];
+            if(snap_dirty_row(i)){
+                print_point_row(cursor.select, snap_get_row(i));
+            }
+            else{
+                print_select_row(cursor.select, i);
+            }
+        }
+        if((int32_t)(time_us_32() - deadline) >= 0){
+            return;
+        }
+    }
+    //Last group - an ungrouped query always has one row, even over no rows at all, and so do PERCENTILEs
+    bool aggregate = (cursor.kind == CURSOR_AGG) || ((cursor.kind == CURSOR_HIST) && (cursor.count == 0)) ||
+        ((cursor.kind >= CURSOR_FLASH) && (cursor.agg.count > 0));
+    if(aggregate && ((cursor.acc.rows > 0) || (cursor.agg.group_col == COL_NONE))){
+        print_agg_row(&cursor.agg, &cursor.acc, cursor.group);
+    }
+    cursor_close();
+}
+
+//Standing queries - SELECT ... EPOCH [ms] is registered once and then only looks at samples as they are inserted
+//Plain ones push every new matching row, aggregates push one row per epoch - no rescans of the table either way
+//Epochs run on sample timestamps, so they stop while collection is paused
+#define MAX_STANDING 4
+struct StandingQuery {
+    bool active;
+    struct QueryPlan plan;
+    struct AggState acc;    // Running values for the current epoch
+    uint32_t epoch_end;     // Timestamp the current epoch closes at
+    bool started;           // False until the first sample sets epoch_end
+};
+static struct StandingQuery standing[MAX_STANDING];
+
+//Returns the slot the query went into, -1 if they are all taken
+int standing_add(const struct QueryPlan *plan){
+    for(int q = 0; q < MAX_STANDING; q++){
+        if(!standing[q].active){
+            struct StandingQuery *sq = &standing[q];
+            sq->plan = *plan;
+            agg_reset(&sq->acc);
+            sq->started = false;
+            sq->active = true;
+            return q;
+        }
+    }
+    return -1;
+}
+
+//Start and end of a standing row - straight into tx when nothing is going out, held back otherwise
+//NULL when the hold is full and the row has to be dropped
+char *standing_begin(){
+    return (cursor.kind == CURSOR_IDLE) ? tx_begin(&tx) : tx_hold_begin(&standing_hold);
+}
+void standing_end(char *end){
+    if(cursor.kind == CURSOR_IDLE){
+        tx_end(&tx, end);
+    }
+    else{
+        tx_hold_end(&standing_hold, end);
+    }
+}
+
+//Run every standing query against the row that was just written
+void standing_ingest(int row){
+    uint32_t now = time_col[row];
+    for(int q = 0; q < MAX_STANDING; q++){
+        struct StandingQuery *sq = &standing[q];
+        if(!sq->active){
+            continue;
+        }
+        uint32_t epoch_us = sq->plan.epoch * 1000;
+        if(!sq->started){
+            sq->epoch_end = now + epoch_us;
+            sq->started = true;
+        }
+        //Close the epoch this sample is past - epochs with no samples in them (a pause) are skipped, not reported
+        if((sq->plan.agg.count > 0) && ((int32_t)(now - sq->epoch_end) >= 0)){
+            char *p = standing_begin();
+            if(p != NULL){
+                p = fmt_str(fmt_u32(fmt_str(fmt_u32(fmt_str(p, "Q"), q), " epoch "), sq->epoch_end - epoch_us), ": ");
+                standing_end(fmt_str(fmt_agg_row(p, &sq->plan.agg, &sq->acc, 0), TX_NEWLINE));
+            }
+            agg_reset(&sq->acc);
+            while((int32_t)(now - sq->epoch_end) >= 0){
+                sq->epoch_end += epoch_us;
+            }
+        }
+        if((sq->plan.where_col != COL_NONE) && !op_match(sq->plan.where_op, column_value(sq->plan.where_col, row), sq->plan.where_val)){
+            continue;
+        }
+        if(sq->plan.agg.count > 0){
+            agg_add(&sq->plan.agg, &sq->acc, row);
+        }
+        else{
+            char *p = standing_begin();
+            if(p != NULL){
+                p = fmt_str(fmt_u32(fmt_str(p, "Q"), q), ": ");
+                standing_end(fmt_str(fmt_select_row(p, sq->plan.select, row), TX_NEWLINE));
+            }
+        }
+    }
+}
+
+//Ingest - write a sample into the table, keeping the indexes up to date and picking the next row to evict once it is full
+static int loop_var = 0;        //Row the next sample goes into
+static int num_samples = 0;     //Samples stored so far
+void table_insert(struct DataPoint point){
+    uint32_t insert_start = time_us_32();
+    //Once the table is full loop_var is the row picked for eviction last time - drop it from the indexes before overwriting it
+    bool evicting = num_samples >= ARRAY_SIZE;
+    struct DataPoint old;
+    //A PERCENTILE or HISTOGRAM result holds back the changes to the potv counts - cut off when there is no room for these
+    if(!hist_room(evicting ? 2 : 1)){
+        cursor_too_old();
+    }
+    if(evicting){
+        old = get_row(loop_var);
+        //A result still reading the table keeps the old values - when there is no room left for them it is cut off instead,
+        //so ingest never waits on it
+        if(!snap_save(loop_var, old)){
+            cursor_too_old();
+        }
+        potv_unlink(loop_var);
+        time_unlink(loop_var);
+    }
+    put_row(loop_var, point);
+    potv_link(loop_var);
+    time_link(loop_var);
+    zone_update(loop_var, evicting ? &old : NULL);
+    standing_ingest(loop_var);
+    if(FLASH_LOG){
+        flash_log_append(&flash_log, point);
+    }
+    if(TS_BLOCKS > 0){
+        ts_store_append(&ts_store, point);
+    }
+
+    //Go to the next loop value
+    loop_var ++;
+    num_samples ++;
+    if(num_samples >= ARRAY_SIZE){
+        //Delete a value which is where the loop_var will insert the new value - point with the smallest distance from the mean
+        uint32_t evict_start = time_us_32();
+        loop_var = evict_pick(ARRAY_SIZE); //Doesn't technically delete it, but will replace the values at row loop_var so it is good enough
+        stat_add(&stats.phase[STAT_EVICT], time_us_32() - evict_start);
+        stat_add(&stats.phase[STAT_INGEST], evict_start - insert_start);
+    }
+    else{
+        stat_add(&stats.phase[STAT_INGEST], time_us_32() - insert_start);
+    }
+}
+
+//Query compiler - SQL text to a QueryPlan, one pass over the characters
+//Grammar I guess: SELECT [var](,[var])?(,[var])?(,[var])?( FROM [source])?( WHERE [var][op][value])( ORDER BY [var](,[var])?(,[var])?(,[var])?( DESC)?)?( LIMIT [value]( OFFSET [value])?)?( FORMAT BINARY)?
+//Or aggregated: SELECT [agg]([var])(,[agg]([var]))*( FROM [source])?( WHERE [var][op][value])( GROUP BY [var](/[value])?)?
+//Either can end in EPOCH [value] instead to keep it running on new samples
+//Valid var names: "time" - ms_time; "potv" - potentiometer_value; "butp" - button_pressed; "ledo" - led_on
+//Valid aggs: COUNT (of * or any var), MIN, MAX, SUM, AVG
+//Valid sources: FLASH - the log in flash; BLOCKS - the compressed blocks in SRAM
+//[value] in the WHERE clause can be ? in a PREPARE, and EXEC fills it in
+#define LEX_SELECT 0
+#define LEX_WHERE 1
+#define LEX_GROUP 2
+#define LEX_ORDER 3
+#define LEX_LIMIT 4
+#define LEX_OFFSET 5
+
+//Column the var name at the start of sql[0..len) is, COL_NONE if it is not one - the whole name has to match, and not run on
+//into more letters
+#define COLUMN_NAME_LEN 4
+#define COLUMN_NAME_CHECK(ID, name, storage, key_bits, field, sample, dump_label) \
+    _Static_assert(sizeof(#name) == COLUMN_NAME_LEN + 1, #name " is not a four letter name");
+TABLE_COLUMNS(COLUMN_NAME_CHECK)
+#define COLUMN_ID_MATCH(ID, name, storage, key_bits, field, sample, dump_label) \
+    if(!buf_comp((uint8_t*) #name, (uint8_t*) sql, COLUMN_NAME_LEN)) return COL_##ID;
+int column_id(const char *sql, int len){
+    if((len < COLUMN_NAME_LEN) || ((len > COLUMN_NAME_LEN) && isalpha((unsigned char)sql[COLUMN_NAME_LEN]))){
+        return COL_NONE;
+    }
+    TABLE_COLUMNS(COLUMN_ID_MATCH)
+    return COL_NONE;
+}
+
+//A lowercase letter only ever starts a column name, so one that does not start a known name is a typo - printed with the
+//reason so the query is turned down rather than run on the wrong column
+bool unknown_column(const char *sql, int len, int col){
+    if((col != COL_NONE) || !islower((unsigned char)sql[0])){
+        return false;
+    }
+    int name_len = 0;
+    while((name_len < len) && isalpha((unsigned char)sql[name_len])){
+        name_len ++;
+    }
+    printf("No column named %.*s\n", name_len, sql);
+    return true;
+}
+
+//sql[0..len) starts with SELECT - only so much checking I'm going to do here, anything after that compiles to something
+//False, with the reason printed, for the few plans that cannot run
+bool compile_query(const char *sql, int len, struct QueryPlan *plan){
+    plan->select = 0;
+    plan->where_col = COL_NONE;
+    plan->where_op = 0;
+    plan->where_val = 0;
+    plan->where_param = false;
+    plan->order_count = 0;
+    plan->order_desc = false;
+    plan->limit = -1;
+    plan->offset = 0;
+    plan->binary = false;
+    plan->source = SOURCE_TABLE;
+    plan->epoch = 0;
+    plan->agg.count = 0;
+    plan->agg.group_col = COL_NONE;
+    plan->agg.group_width = 0;
+    int state = LEX_SELECT;
+    int cur_idx = 7;
+    while(cur_idx < len){
+        char c = sql[cur_idx];
+        char next = (cur_idx + 1 < len) ? sql[cur_idx + 1] : 0;
+        int col = column_id(sql + cur_idx, len - cur_idx);
+        if(unknown_column(sql + cur_idx, len - cur_idx, col)){
+            return false;
+        }
+        //FROM FLASH or FROM BLOCKS right after the select list
+        if((c == ' ') && (next == 'F') && (cur_idx + 2 < len) && (sql[cur_idx + 2] == 'R')){
+            cur_idx += 6;
+            if(cur_idx < len){
+                plan->source = (sql[cur_idx] == 'F') ? SOURCE_FLASH : SOURCE_BLOCKS;
+            }
+            while((cur_idx < len) && (sql[cur_idx] != ' ')){
+                cur_idx ++;
+            }
+            continue;
+        }
+        //FORMAT BINARY ends the query wherever it shows up
+        if((c == ' ') && (next == 'F')){
+            plan->binary = true;
+            break;
+        }
+        //So does EPOCH, with the period after it
+        if((c == ' ') && (next == 'E')){
+            for(cur_idx += 2; cur_idx < len; cur_idx++){
+                if(isdigit((unsigned char)sql[cur_idx])){
+                    plan->epoch *= 10;
+                    plan->epoch += sql[cur_idx] - 48;
+                }
+            }
+            if(plan->epoch == 0){
+                plan->epoch = 1; //EPOCH 0 would close an epoch every sample anyway
+            }
+            break;
+        }
+        //Start of a clause - skip the keyword and the space after it
+        if((c == ' ') && (next == 'W')){
+            cur_idx += 7;
+            state = LEX_WHERE;
+        }
+        else if((c == ' ') && (next == 'G')){
+            cur_idx += 10;
+            state = LEX_GROUP;
+        }
+        else if((c == ' ') && (next == 'O') && (cur_idx + 2 < len) && (sql[cur_idx + 2] == 'F')){
+            cur_idx += 8;
+            state = LEX_OFFSET;
+        }
+        else if((c == ' ') && (next == 'O')){
+            cur_idx += 10;
+            state = LEX_ORDER;
+        }
+        else if((c == ' ') && (next == 'L')){
+            cur_idx += 7;
+            state = LEX_LIMIT;
+            plan->limit = 0;
+        }
+        else if((c == ' ') && (next == 'D')){
+            cur_idx += 5;
+            plan->order_desc = true;
+        }
+        else if(state == LEX_SELECT){
+            //Aggregate - NAME(var) or NAME(*)
+            if(isupper((unsigned char)c)){
+                int func = agg_func(sql + cur_idx);
+                while((cur_idx < len) && (sql[cur_idx] != '(')){
+                    cur_idx ++;
+                }
+                cur_idx ++;
+                int agg_col = (cur_idx < len) ? column_id(sql + cur_idx, len - cur_idx) : COL_NONE;
+                if((cur_idx < len) && unknown_column(sql + cur_idx, len - cur_idx, agg_col)){
+                    return false;
+                }
+                //PERCENTILE(potv, 0.99) and HISTOGRAM(potv, 16) have a number after the column - whole part and millionths
+                uint32_t whole = 0;
+                uint32_t frac = 0;
+                uint32_t scale = HIST_ONE;
+                bool number = false;
+                bool point = false;
+                while((cur_idx < len) && (sql[cur_idx] != ')')){
+                    char d = sql[cur_idx++];
+                    if(d == ','){
+                        number = true;
+                    }
+                    else if(number && (d == '.')){
+                        point = true;
+                    }
+                    else if(number && isdigit((unsigned char)d)){
+                        if(!point){
+                            whole = whole * 10 + d - 48;
+                        }
+                        else if(scale > 1){
+                            scale /= 10;
+                            frac += (d - 48) * scale;
+                        }
+                    }
+                }
+                cur_idx ++;
+                //Only COUNT makes sense over *
+                if((func != 0) && ((agg_col != COL_NONE) || (func == AGG_COUNT)) && (plan->agg.count < MAX_AGGS)){
+                    uint32_t param = 0;
+                    if(func == AGG_PERCENTILE){
+                        //The median when no fraction is given
+                        param = !number ? HIST_ONE / 2 : (whole >= 1) ? HIST_ONE : frac;
+                    }
+                    else if(func == AGG_HISTOGRAM){
+                        param = (whole == 0) ? HIST_BIN_LEVELS : (whole > ADC_LEVELS) ? ADC_LEVELS : whole;
+                    }
+                    plan->agg.funcs[plan->agg.count] = func;
+                    plan->agg.cols[plan->agg.count] = agg_col;
+                    plan->agg.params[plan->agg.count] = param;
+                    plan->agg.count ++;
+                }
+            }
+            else if(col != COL_NONE){
+                plan->select |= COL_BIT(col);
+                cur_idx += COLUMN_NAME_LEN;
+            }
+            else if(c == '*'){
+                plan->select = ALL_COLS;
+                cur_idx ++;
+            }
+            else{
+                cur_idx ++; //I think this technically means that anything could be a valid query
+            }
+        }
+        else if(state == LEX_WHERE){
+            //Where clause operand
+            if(col != COL_NONE){
+                plan->where_col = col;
+                cur_idx += COLUMN_NAME_LEN;
+            }
+            //Where clause operator - a trailing = adds 3, so <= is 4, >= is 5 and != is 6
+            else if(c == '!'){
+                plan->where_op = OP_EQ;
+                cur_idx ++;
+            }
+            else if(c == '<'){
+                plan->where_op = OP_LT;
+                cur_idx ++;
+            }
+            else if(c == '>'){
+                plan->where_op = OP_GT;
+                cur_idx ++;
+            }
+            else if(c == '='){
+                plan->where_op += OP_EQ;
+                cur_idx ++;
+            }
+            //Where clause value
+            else if(isdigit((unsigned char)c)){
+                plan->where_val *= 10;
+                plan->where_val += c - 48; //Just subtract the ascii value of the character
+                cur_idx ++;
+            }
+            else if(c == '?'){
+                plan->where_param = true;
+                cur_idx ++;
+            }
+            else{
+                cur_idx ++;
+            }
+        }
+        else if((state == LEX_LIMIT) || (state == LEX_OFFSET)){
+            int *value = (state == LEX_LIMIT) ? &plan->limit : &plan->offset;
+            if(isdigit((unsigned char)c)){
+                *value = *value * 10 + c - 48;
+            }
+            cur_idx ++;
+        }
+        else if(state == LEX_GROUP){
+            //Group column and optional bucket width
+            if(col != COL_NONE){
+                plan->agg.group_col = col;
+                cur_idx += COLUMN_NAME_LEN;
+            }
+            else if(isdigit((unsigned char)c)){
+                plan->agg.group_width *= 10;
+                plan->agg.group_width += c - 48;
+                cur_idx ++;
+            }
+            else{
+                cur_idx ++;
+            }
+        }
+        else{
+            //A column listed again adds nothing to the order - only its first place counts
+            bool listed = false;
+            for(int k = 0; k < plan->order_count; k++){
+                listed |= (plan->order_cols[k] == col);
+            }
+            if((col != COL_NONE) && !listed && (plan->order_count < MAX_SORT_KEYS)){
+                plan->order_cols[plan->order_count++] = col;
+            }
+            cur_idx += (col != COL_NONE) ? COLUMN_NAME_LEN : 1;
+        }
+    }
+    //The ORDER BY columns are packed into one uint64_t key
+    int order_bits = key_bits(plan->order_cols, plan->order_count);
+    if(order_bits > 64){
+        printf("ORDER BY key is %d bits, more than the 64 it can be\n", order_bits);
+        return false;
+    }
+    //Aggregates come out one row per group, in group order - sorting on the group column puts every group in one run of sel
+    //and the ORDER BY machinery already gets time and potv straight out of their indexes
+    if(plan->agg.count > 0){
+        plan->binary = false;
+        plan->order_count = 0;
+        plan->order_desc = false;
+        plan->limit = -1;
+        plan->offset = 0;
+        if(plan->agg.group_col != COL_NONE){
+            plan->order_cols[plan->order_count++] = plan->agg.group_col;
+        }
+        if(plan->agg.group_width == 0){
+            plan->agg.group_width = 1;
+        }
+    }
+    return true;
+}
+
+//WHERE on a column that is not the source index - candidates are filtered in place, keeping whatever order they came in,
+//until limit of them have passed
+//One loop per column and operator, generated from TABLE_COLUMNS, so every combination gets its own tight loop with the
+//comparison inlined. The loops have no branch on the comparison - every row is written to sel[kept] and kept only moves
+//past it when it matched, so a WHERE that matches about half the rows costs no mispredictions
+#define FILTER_LOOP(value, cmp) \
+    for(int k = 0; (k < count) && (kept < limit); k++){ \
+        int i = sel[k]; \
+        sel[kept] = i; \
+        kept += ((value) cmp val); \
+    }
+#define FILTER_OPS(value) \
+    switch(op){ \
+        case OP_LT: FILTER_LOOP(value, <) break; \
+        case OP_GT: FILTER_LOOP(value, >) break; \
+        case OP_EQ: FILTER_LOOP(value, ==) break; \
+        case OP_LE: FILTER_LOOP(value, <=) break; \
+        case OP_GE: FILTER_LOOP(value, >=) break; \
+        case OP_NE: FILTER_LOOP(value, !=) break; \
+    }
+#define FILTER_CASE(ID, name, storage, key_bits, field, sample, dump_label) \
+    case COL_##ID: FILTER_OPS(COLUMN_LOAD_##storage(name##_col, i)) break;
+int filter_sel(int col, int op, uint32_t val, int count, int limit){
+    int kept = 0;
+    switch(col){
+        TABLE_COLUMNS(FILTER_CASE)
+    }
+    return kept;
+}
 
-// This function's code is from: https://blog.smittytone.net/2021/10/31/how-to-send-data-to-a-raspberry-pi-pico-via-usb/
-uint16_t get_block(uint8_t *buffer) {
-  uint16_t buffer_index= 0;
-  while (true) {
-    int c = getchar_timeout_us(100);
-    if (c != PICO_ERROR_TIMEOUT && buffer_index < BUFFER_SIZE) {
-      buffer[buffer_index++] = (c & 0x1FF);
-    } else {
-      break;
+//Executor - runs a plan by filling sel and opening the cursor on it, or registers it when it is a standing query
+void run_plan(const struct QueryPlan *plan, uint32_t start){
+    if(agg_uses_hist(&plan->agg)){
+        //potv_hist only knows about the whole table as it is now
+        bool whole_table = (plan->epoch == 0) && (plan->source == SOURCE_TABLE) && (plan->where_col == COL_NONE) && (plan->agg.group_col == COL_NONE);
+        if(!whole_table || !agg_hist_only(&plan->agg)){
+            printf("PERCENTILE and HISTOGRAM only go with COUNT(*) and other potv aggregates, over the whole table\n");
+            return;
+        }
+        bool histogram = plan->agg.funcs[0] == AGG_HISTOGRAM;
+        cursor_open(CURSOR_HIST, false, 0, histogram ? (ADC_LEVELS + plan->agg.params[0] - 1) / plan->agg.params[0] : 0, start, &plan->agg);
+        return;
+    }
+    if(plan->epoch > 0){
+        //Standing query - nothing runs now, standing_ingest picks it up from the next sample on
+        //An aggregate one keeps a single running row per epoch, so there is nowhere for groups to go
+        if(plan->agg.group_col != COL_NONE){
+            printf("GROUP BY does not go with EPOCH - a standing aggregate sends one row per epoch\n");
+            return;
+        }
+        int q = standing_add(plan);
+        if(q < 0){
+            printf("No free standing query slots\n");
+        }
+        else{
+            printf("Standing query %d every %u ms\n", q, plan->epoch);
+            if(plan->agg.count > 0){
+                print_agg_header(&standing[q].plan.agg);
+            }
+            else{
+                print_select_header(plan->select);
+            }
+        }
+        return;
+    }
+    if(plan->source != SOURCE_TABLE){
+        //History is kept in the order samples came in, so time order is all it can give - rows and groups come straight
+        //off the pages or blocks as they are decoded
+        bool time_order = (plan->order_count == 0) || ((plan->order_count == 1) && (plan->order_cols[0] == COL_TIME) && !plan->order_desc);
+        bool kept = (plan->source == SOURCE_FLASH) ? FLASH_LOG : (TS_BLOCKS > 0);
+        if(!kept || !time_order){
+            printf("FROM FLASH and FROM BLOCKS only run in time order, and only when that history is kept\n");
+            return;
+        }
+        if(plan->source == SOURCE_FLASH){
+            cursor_open(CURSOR_FLASH, false, plan->select, flash_log_pages(&flash_log), start, (plan->agg.count > 0) ? &plan->agg : NULL);
+        }
+        else{
+            uint32_t first = ts_store_oldest(&ts_store);
+            cursor_open(CURSOR_BLOCKS, false, plan->select, ts_store.sealed - first + 1, start, (plan->agg.count > 0) ? &plan->agg : NULL);
+            cursor.first = first;
+        }
+        cursor.where_col = plan->where_col;
+        cursor.where_op = plan->where_op;
+        cursor.where_val = plan->where_val;
+        cursor.offset = plan->offset;
+        cursor.limit = plan->limit;
+        if(cursor.limit == 0){
+            cursor.pos = cursor.count;
+        }
+        return;
+    }
+    int arr_len = num_samples > ARRAY_SIZE ? ARRAY_SIZE : num_samples;
+    int where_col = plan->where_col;
+    int where_op = plan->where_op;
+    uint32_t where_val = plan->where_val;
+    //LIMIT and OFFSET - only the first want rows of the order are ever needed
+    int want = (plan->limit < 0) ? ARRAY_SIZE : plan->offset + plan->limit;
+    if((want < 0) || (want > ARRAY_SIZE)){
+        want = ARRAY_SIZE;
+    }
+    //The WHERE clause fills sel[0..count) with the ids of matching rows - nothing is copied out of the table
+    uint32_t filter_start = time_us_32();
+    int count = 0;
+    //The last ORDER BY key can come straight out of its index when it is time or potv - the radix sort is stable,
+    //so after that only the keys in front of it need sorting. DESC flips every key, so an index only helps when it is the
+    //only key, and then it is read backwards
+    int last_key = (plan->order_count > 0) ? plan->order_cols[plan->order_count - 1] : COL_NONE;
+    bool by_index = ((last_key == COL_TIME) || (last_key == COL_POTV)) && (!plan->order_desc || (plan->order_count == 1));
+    int sort_keys = by_index ? plan->order_count - 1 : plan->order_count;
+    bool reverse = by_index && plan->order_desc;
+    //Pick the index the candidate rows come out of - the ORDER BY column if it has one, otherwise the WHERE column
+    int src_col = by_index ? last_key : COL_NONE;
+    if((plan->order_count == 0) && ((where_col == COL_TIME) || (where_col == COL_POTV))){
+        src_col = where_col;
+    }
+    //Rows come out of the index in their final order when there is nothing left to sort, so filling can stop at want
+    bool filtering = (where_col != COL_NONE) && (where_col != src_col);
+    int limit = ((sort_keys == 0) && !reverse) ? want : ARRAY_SIZE;
+    int fill_limit = filtering ? ARRAY_SIZE : limit;
+    if(reverse && (last_key == COL_TIME) && (where_col == COL_NONE)){
+        //The newest rows - straight in from the new end of the time index, already newest first
+        count = time_latest(want);
+        reverse = false;
+    }
+    else if(src_col == COL_TIME){
+        //Time predicates walk in from the end of the time index the matches are at and stop at the boundary
+        count = (where_col == COL_TIME) ? time_range(where_op, where_val, fill_limit) : time_walk(fill_limit);
+    }
+    else if(src_col == COL_POTV){
+        //Potv predicates only visit the buckets inside the range
+        count = (where_col == COL_POTV) ? potv_range(where_op, (where_val > ADC_LEVELS) ? ADC_LEVELS : where_val, fill_limit) : potv_walk(fill_limit);
+    }
+    else if(where_col != COL_NONE){
+        //No index to go on - the zone maps rule out whole chunks before any row is looked at
+        count = zone_scan(where_col, where_op, where_val, arr_len);
+    }
+    else{
+        count = (arr_len < fill_limit) ? arr_len : fill_limit;
+        for(int i = 0; i < count; i++){
+            sel[i] = i;
+        }
+    }
+    //Rows scanned are the candidates the index or zone maps gave up, before the rest of the WHERE clause is checked on them
+    stats.rows_scanned += count;
+    if(filtering){
+        count = filter_sel(where_col, where_op, where_val, count, limit);
+    }
+    stats.rows_returned += count;
+    uint32_t sort_start = time_us_32();
+    stat_add(&stats.phase[STAT_FILTER], sort_start - filter_start);
+    if(sort_keys > 0){
+        //A short LIMIT keeps a heap of the best rows rather than putting every row in order
+        if((want < count) && (want <= TOPK_MAX) && (key_bits(plan->order_cols, sort_keys) <= TOPK_KEY_BITS)){
+            count = top_k(plan->order_cols, sort_keys, plan->order_desc, count, want);
+        }
+        else{
+            radix_sort(plan->order_cols, sort_keys, plan->order_desc, count);
+        }
+        stat_add(&stats.phase[STAT_SORT], time_us_32() - sort_start);
+    }
+    else if(reverse){
+        //DESC on an index column - the index order backwards, so equal values come out newest first
+        for(int a = 0, b = count - 1; a < b; a++, b--){
+            uint16_t tmp = sel[a];
+            sel[a] = sel[b];
+            sel[b] = tmp;
+        }
+    }
+    if(count > want){
+        count = want;
+    }
+    //OFFSET - the rows in front of the ones asked for go
+    int offset = (plan->offset < count) ? plan->offset : count;
+    if(offset > 0){
+        for(int i = offset; i < count; i++){
+            sel[i - offset] = sel[i];
+        }
+        count -= offset;
+    }
+    //Projection last - rows go out a slice per loop from cursor_step once data collection is done
+    //Aggregates are worked out in the same slices, so a big GROUP BY cannot hold up sampling either
+    if(plan->agg.count > 0){
+        cursor_open(CURSOR_AGG, false, 0, count, start, &plan->agg);
+    }
+    else{
+        cursor_open(CURSOR_SELECT, plan->binary, plan->select, count, start, NULL);
     }
-  }
-  return buffer_index;
 }
 
-bool buf_comp(uint8_t *buf1, uint8_t *buf2, int len){
-    for(int i = 0; i < len; i++){
-        if(buf1[i] != buf2[i]){
-            return true;
+//Plan cache - PREPARE compiles a query into a free slot, or the least recently used one, and EXEC [handle] runs it from there
+#define PLAN_CACHE_SIZE 8
+struct CachedPlan {
+    bool used;
+    uint32_t last_used;     // plan_clock when it was last prepared or run
+    struct QueryPlan plan;
+};
+static struct CachedPlan plan_cache[PLAN_CACHE_SIZE];
+static uint32_t plan_clock = 0;
+
+//Returns the plan's handle
+int plan_store(const struct QueryPlan *plan){
+    int handle = 0;
+    for(int h = 0; h < PLAN_CACHE_SIZE; h++){
+        if(!plan_cache[h].used){
+            handle = h;
+            break;
+        }
+        if(plan_cache[h].last_used < plan_cache[handle].last_used){
+            handle = h;
         }
     }
-    return false;
+    plan_cache[handle].used = true;
+    plan_cache[handle].last_used = ++plan_clock;
+    plan_cache[handle].plan = *plan;
+    return handle;
 }
 
-//Comparison functions for ORDER BY
-int compareDPTime(const void* a, const void* b){
-    uint32_t x = ((struct DataPoint*) a) -> ms_time;
-    uint32_t y = ((struct DataPoint*) b) -> ms_time;
-    if (x < y) return -1;
-    if (x > y) return 1;
-    return 0;
+//Copy a cached plan out for EXEC, with param as its WHERE value if it was prepared with a ?
+//Returns false (and says why) if there is nothing to run
+bool plan_load(int handle, bool has_param, uint32_t param, struct QueryPlan *plan){
+    if((handle < 0) || (handle >= PLAN_CACHE_SIZE) || !plan_cache[handle].used){
+        printf("No plan %d\n", handle);
+        return false;
+    }
+    if(plan_cache[handle].plan.where_param && !has_param){
+        printf("Plan %d needs a value\n", handle);
+        return false;
+    }
+    plan_cache[handle].last_used = ++plan_clock;
+    *plan = plan_cache[handle].plan;
+    if(plan->where_param){
+        plan->where_val = param;
+    }
+    return true;
 }
-int compareDPPot(const void* a, const void* b){
-    uint16_t x = ((struct DataPoint*) a) -> potentiometer_value;
-    uint16_t y = ((struct DataPoint*) b) -> potentiometer_value;
-    if (x < y) return -1;
-    if (x > y) return 1;
-    return 0;
+
+//Sampling runs on core1 and hands samples to core0, which owns the table, through this ring
+//Neither side ever waits on the other - queries cannot delay a sample and sampling cannot stall a query
+static struct SampleRing samples;
+//Allow or prevent data collection - written by core0 on PAUSE/GO, read by core1
+static volatile bool collect = true;
+
+//With ADC_DMA_HZ set the ADC runs free and DMA fills these staging blocks, core0 drains them in batches
+static struct AdcStream adc_stream;
+
+//Serial input - filled from the USB interrupt as bytes arrive, so nothing waits on getchar and no command has to fit a poll window
+static struct RxRing rx;
+static struct RxLine rx_line;
+//Whole commands waiting for the result in flight to finish, and the one being run this loop
+static struct RxQueue rx_queue;
+static char command[RX_LINE_MAX + 1];
+
+//PAUSE, STOP and CANCEL do not wait in the queue to cut off the result in flight - the rest of what they do still waits
+//CANCEL does nothing else, its reply is the Cancelled line or early end frame of the result it cut off
+bool cancels_result(char *cmd, int len){
+    return ((len == 5) && !buf_comp((uint8_t*) "PAUSE", (uint8_t*) cmd, 5)) ||
+           ((len >= 4) && !buf_comp((uint8_t*) "STOP", (uint8_t*) cmd, 4)) ||
+           ((len == 6) && !buf_comp((uint8_t*) "CANCEL", (uint8_t*) cmd, 6));
+}
+
+//Runs in interrupt context whenever USB stdio has new characters - take all of them
+void rx_chars_available(void *param){
+    int c;
+    while((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT){
+        rx_ring_put(&rx, c, time_us_32());
+    }
+}
+
+//Sample sink for adc_stream_drain
+void ingest_sample(struct DataPoint point){
+    if(collect){
+        table_insert(point);
+    }
 }
-int compareDPBut(const void* a, const void* b){
-    return ((struct DataPoint*) a) -> button_pressed - ((struct DataPoint*) b) -> button_pressed;
+
+#define SAMPLE_FIELD(ID, name, storage, key_bits, field, sample, dump_label) point.field = (sample);
+
+void sampler_main(){
+    //Core0 parks this core while it writes the flash log - nothing here can run from flash while that is going on
+    flash_safe_execute_core_init();
+    if(ADC_DMA_HZ > 0){
+        //Hardware-timed - the only work left for this core is the DMA interrupt at the end of every block
+        adc_dma_start(&adc_stream, ADC_DMA_HZ, BUTTON_PIN);
+        while(true){
+            __wfi();
+        }
+    }
+    uint32_t next_sample = time_us_32();
+    while(true){
+        if(collect){
+            struct DataPoint point;
+            TABLE_COLUMNS(SAMPLE_FIELD)                         // Read every column from its source in datapoint.h
+            sample_ring_push(&samples, point);
+
+            //Code for displaying new data collected
+            // printf("Reading: Potentiometer = %u, Button = %s\n", 
+            //        point.potentiometer_value, 
+            //        point.button_pressed ? "Pressed" : "Released");
+        }
+        //Fixed period from the first sample, so a late wakeup does not push every later sample back
+        next_sample += MS_BT_LOOP * 1000;
+        int32_t time_left = (int32_t)(next_sample - time_us_32());
+        if(time_left > 0){
+            sleep_us(time_left);
+        }
+    }
 }
-int compareDPLed(const void* a, const void* b){
-    return ((struct DataPoint*) a) -> led_on - ((struct DataPoint*) b) -> led_on;
+
+//Everything the table and the history behind it need before the first sample - empty indexes, the end of the flash log found,
+//and somewhere for standing query rows to go
+void db_init(){
+    index_init();
+    tx_init(&tx, tx_room, tx_write);
+    if(FLASH_LOG){
+        flash_dev_pico_init(&flash_dev);
+        flash_log_open(&flash_log, &flash_dev);
+    }
+    ts_store_init(&ts_store, ts_blocks, TS_BLOCKS > 0 ? TS_BLOCKS : 1);
 }
 
 int main(){
-    // Array to store the data
-    struct DataPoint data[ARRAY_SIZE];
+    //Before anything has gone deep into the stack, so the peak STATS reports is all there is
+    stack_paint();
+    stats_reset();
 
     //Initialize chosen serial port
     stdio_init_all();
+    rx_ring_init(&rx, &rx_line);
+    rx_queue_init(&rx_queue);
+    stdio_set_chars_available_callback(rx_chars_available, NULL);
 
     // Initialize the ADC
     adc_init();
@@ -101,26 +2298,24 @@ int main(){
     gpio_init(LED_PIN);
     gpio_set_dir(LED_PIN, GPIO_OUT);
 
+    //Empty table, history picked up from flash
+    db_init();
+
     //Get a random id value
     uint32_t pico_id = get_rand_32();
 
-    //Keep track of the indices that need to be changed
-    int loop_var = 0;
-    //Keep track of the size of the array
-    int num_samples = 0;
+    //Start sampling on the other core
+    sample_ring_init(&samples);
+    multicore_launch_core1(sampler_main);
+
     //Follows num_samples until it is too large, and then just follows ARRAY_SIZE
     int arr_len = 0;
     
-    // Create a buffer to store the input string
-    char input_buffer[BUFFER_SIZE];
-    int buffer_index = 0;
-    char last_buffer[BUFFER_SIZE];
-    int last_buffer_index = 0;
+    //The command being looked at this loop - popped off the RX queue
+    char *input_buffer = command;
 
     //Initiate communication with the Pi flag
     bool speak = false;
-    //Allow or prevent data collection
-    bool collect = true;
 
     //Time to reference when measuring time since start
     uint32_t start = time_us_32();
@@ -130,21 +2325,9 @@ int main(){
     uint32_t loop_end = time_us_32();
     uint32_t loop_time = time_us_32();
 
-    //For testing
-    double cur_variance_sum = 0;
-
-    //Query attributes
-    bool select = false;
-    int select_subj = 0;
-    bool where = false;
-    int where_var = 0;
-    char where_op = 0; //0 - x, 1 - <, 2 - >, 3 - =, 4 - <=, 5 - >=, 6 - <>
-    int where_val = 0;
-    bool orderby = false;
-    int orderby_pred = 0;
-    //Grammar I guess: SELECT [var](,[var])?(,[var])?(,[var])?( WHERE [var][op][value])( ORDER BY [var](,[var])?(,[var])?(,[var])?)?
-    //Valid var names: "time" - ms_time; "potv" - potentiometer_value; "butp" - button_pressed; "ledo" - led_on
-    //Var encodings - time = 1000; potv = 100; butp = 10; ledo = 1
+    //Query to run this loop - compiled from a SELECT or loaded from the plan cache by EXEC
+    struct QueryPlan plan;
+    bool query = false;
 
     //Loop forever
     while(true){
@@ -160,28 +2343,31 @@ int main(){
 
         //----------------------------------------------------------------------------------------------------
         //Read from serial
-        int read_until = get_block(input_buffer); //returns final index of the buffer
-        //Only echo if the input buffer and last buffer read are different
-        bool is_different = false;
-        if(read_until == last_buffer_index){
-            is_different = buf_comp(last_buffer, input_buffer, read_until);
+        //Every whole command in the RX ring moves to the RX queue each loop, so the ring never fills up behind a big DUMP
+        //They run one per loop in the order they were sent, but only once no result is going out, so pipelined queries come
+        //back one whole result after another - PAUSE, STOP and CANCEL cut the result in flight off as soon as they are read
+        int read_until = 0; //Length of the command in input_buffer
+        uint32_t serial_start = time_us_32();
+        while(rx_queue_room(&rx_queue) && ((read_until = rx_next_command(&rx, &rx_line, time_us_32())) != -1)){
+            if(cancels_result(rx_line.buf, read_until)){
+                cursor_cancel();
+            }
+            rx_queue_push(&rx_queue, rx_line.buf, read_until);
         }
-        else{
-            is_different = true;
+        read_until = (cursor.kind == CURSOR_IDLE) ? rx_queue_pop(&rx_queue, input_buffer) : -1;
+        if(read_until != -1){
+            stat_add(&stats.phase[STAT_SERIAL], time_us_32() - serial_start);
+            //Replies go out with printf - standing query rows still in the TX buffer have to go first
+            tx_flush(&tx);
         }
-        if(is_different){
-            //Make sure to clean out the buffer - get block can create garbage
-            for(int i = read_until; i < BUFFER_SIZE; i++){
-                input_buffer[i] = 0;
-                last_buffer[i] = 0;
-            }
-            //Uncomment for echoing the output
-            // printf("Echo: %s\n", input_buffer);
-            //Copy data from the input buffer to the last buffer so that they are the same
-            for(int i = 0; i < read_until; i++){
-                last_buffer[i] = input_buffer[i];
-            }
+        if(read_until == RX_TOO_LONG){
+            printf("Command too long\n");
         }
+        if(read_until < 0){
+            read_until = 0;
+        }
+        //Uncomment for echoing the output
+        // printf("Echo: %s\n", input_buffer);
         //----------------------------------------------------------------------------------------------------
 
         //----------------------------------------------------------------------------------------------------
@@ -189,9 +2375,15 @@ int main(){
         char *helomsg = "HELO";
         char *timemsg = "TIME";
         char *dumpmsg = "DUMP";
+        char *dumpbmsg = "DUMPB";
         char *querymsg = "SELECT";
         char *pausemsg = "PAUSE";
         char *gomsg = "GO";
+        char *stopmsg = "STOP";
+        char *preparemsg = "PREPARE ";
+        char *execmsg = "EXEC ";
+        char *statsmsg = "STATS";
+        char *resetmsg = "STATS RESET";
 
         //If the message is HELO send the Pico's id for communication - may be useful for broadcast information
         if((read_until == 4) && !(buf_comp(helomsg, input_buffer, read_until))){
@@ -203,153 +2395,67 @@ int main(){
             printf("Loop Time: %u\n", loop_time);
         }
         //If the message is DUMP send the data - may be useful for debugging and such
-        if((read_until == 4) && !(buf_comp(dumpmsg, input_buffer, read_until))){
-            ms_used = time_us_32();
-            // if(cur_variance_sum != 0.0){
-            //     printf("Current variance sum: %f\n", cur_variance_sum);
-            // }
-            printf("Dumping %d lines\nTime: %u\n", arr_len, ms_used);
-            uint32_t before_dump = time_us_32();
+        //DUMPB sends the same rows as binary frames - a fraction of the bytes
+        bool dump = (read_until == 4) && !(buf_comp(dumpmsg, input_buffer, read_until));
+        bool dumpb = (read_until == 5) && !(buf_comp(dumpbmsg, input_buffer, read_until));
+        if(dump || dumpb){
             for(int i = 0; i < arr_len; i++){
-                printf("Index: %d\tTimestamp: %u\tPotentiometer %u\tButton: %d\tLED: %d\n",
-                i, data[i].ms_time, data[i].potentiometer_value, data[i].button_pressed, data[i].led_on);
+                sel[i] = i;
             }
-            uint32_t dump = time_us_32() - before_dump;
-            printf("Time to print %u", dump);
+            cursor_open(CURSOR_DUMP, dumpb, ALL_COLS, arr_len, time_us_32(), NULL);
         }
-        //Else determine if it is a query - only so much checking I'm going to do here
+        //Else determine if it is a query - it gets compiled here and run in the SQL section below
         if((read_until > 6) && !(buf_comp(querymsg, input_buffer, 6))){
-            int cur_idx = 7;
-            select = false;
-            select_subj = 0;
-            where = false;
-            where_var = 0;
-            where_op = 0; //0 - x, 1 - <, 2 - >, 3 - =, 4 - <=, 5 - >=, 6 - !=
-            where_val = 0;
-            orderby = false;
-            orderby_pred = 0;
-            bool wherec = false;
-            while(cur_idx < read_until){
-                // printf("Iteration through the cur_idx %d\n", cur_idx);
-                if(!select){
-                    if((input_buffer[cur_idx] == ' ') && (input_buffer[cur_idx + 1] == 'W')){
-                        cur_idx += 7;
-                        select = true;
-                        where = true;
-                    }
-                    else if((input_buffer[cur_idx] == ' ') && (input_buffer[cur_idx + 1] == 'O')){
-                        cur_idx += 10;
-                        select = true;
-                        wherec = true;
-                        orderby = true;
-                    }
-                    else if(input_buffer[cur_idx] == 't'){
-                        select_subj += 1000;
-                        cur_idx += 4;
-                    }
-                    else if(input_buffer[cur_idx] == 'p'){
-                        select_subj += 100;
-                        cur_idx += 4;
-                    }
-                    else if(input_buffer[cur_idx] == 'b'){
-                        select_subj += 10;
-                        cur_idx += 4;
-                    }
-                    else if(input_buffer[cur_idx] == 'l'){
-                        select_subj += 1;
-                        cur_idx += 4;
-                    }
-                    else if(input_buffer[cur_idx] == '*'){
-                        select_subj = 1111;
-                        cur_idx ++;
-                    }
-                    else{
-                        cur_idx ++; //I think this technically means that anything could be a valid query
-                    }
+            uint32_t parse_start = time_us_32();
+            query = compile_query(input_buffer, read_until, &plan);
+            stat_add(&stats.phase[STAT_PARSE], time_us_32() - parse_start);
+        }
+        //If the message is PREPARE [query] compile it into the plan cache and send back its handle - nothing runs yet
+        //Only a SELECT that runs once can be prepared - a standing query is registered once anyway, so there is nothing to cache
+        if((read_until >= 8) && !(buf_comp(preparemsg, input_buffer, 8))){
+            struct QueryPlan prepared;
+            if((read_until <= 14) || buf_comp(querymsg, input_buffer + 8, 6)){
+                printf("PREPARE only takes a SELECT\n");
+            }
+            else{
+                uint32_t parse_start = time_us_32();
+                bool compiled = compile_query(input_buffer + 8, read_until - 8, &prepared);
+                stat_add(&stats.phase[STAT_PARSE], time_us_32() - parse_start);
+                if(compiled && (prepared.epoch > 0)){
+                    printf("PREPARE does not take EPOCH - send the standing query as it is\n");
                 }
-                else if(!wherec){
-                    //End of where clause
-                    if((input_buffer[cur_idx] == ' ') && (input_buffer[cur_idx + 1] == 'O')){
-                        cur_idx += 10;
-                        orderby = true;
-                        wherec = true;
-                    }
-                    //Where clause operand
-                    else if(input_buffer[cur_idx] == 't'){
-                        where_var += 1000;
-                        cur_idx += 4;
-                    }
-                    else if(input_buffer[cur_idx] == 'p'){
-                        where_var += 100;
-                        cur_idx += 4;
-                    }
-                    else if(input_buffer[cur_idx] == 'b'){
-                        where_var += 10;
-                        cur_idx += 4;
-                    }
-                    else if(input_buffer[cur_idx] == 'l'){
-                        where_var += 1;
-                        cur_idx += 4;
-                    }
-                    //Where clause operator
-                    else if(input_buffer[cur_idx] == '!'){
-                        where_op = 3;
-                        cur_idx ++;
-                    }
-                    else if(input_buffer[cur_idx] == '<'){
-                        where_op = 1;
-                        cur_idx ++;
-                    }
-                    else if(input_buffer[cur_idx] == '>'){
-                        where_op = 2;
-                        cur_idx ++;
-                    }
-                    else if(input_buffer[cur_idx] == '='){
-                        where_op += 3;
-                        cur_idx ++;
-                    }
-                    //Where clause value
-                    else if(isdigit(input_buffer[cur_idx])){
-                        where_val *= 10;
-                        where_val += input_buffer[cur_idx] - 48; //Just subtract the ascii value of the character
-                        cur_idx ++;
-                    }
-                    else{
-                        cur_idx ++;
-                    }
+                else if(compiled){
+                    printf("Prepared %d\n", plan_store(&prepared));
                 }
-                else{
-                    if(input_buffer[cur_idx] == 't'){
-                        orderby_pred += 1000;
-                        cur_idx += 4;
-                    }
-                    else if(input_buffer[cur_idx] == 'p'){
-                        orderby_pred += 100;
-                        orderby = true;
-                        cur_idx += 4;
-                    }
-                    else if(input_buffer[cur_idx] == 'b'){
-                        orderby_pred += 10;
-                        orderby = true;
-                        cur_idx += 4;
-                    }
-                    else if(input_buffer[cur_idx] == 'l'){
-                        orderby_pred += 1;
-                        orderby = true;
-                        cur_idx += 4;
-                    }
-                    else{
-                        cur_idx ++; //I think this technically means that anything could be a valid query
-                    }
+            }
+        }
+        //If the message is EXEC [handle]( [value])? run a prepared plan - the value goes in place of the ? in its WHERE clause
+        if((read_until > 5) && !(buf_comp(execmsg, input_buffer, 5))){
+            int cur_idx = 5;
+            int handle = 0;
+            while((cur_idx < read_until) && isdigit(input_buffer[cur_idx])){
+                handle = handle * 10 + input_buffer[cur_idx] - 48;
+                cur_idx ++;
+            }
+            bool has_param = false;
+            uint32_t param = 0;
+            for(; cur_idx < read_until; cur_idx++){
+                if(isdigit(input_buffer[cur_idx])){
+                    param = param * 10 + input_buffer[cur_idx] - 48;
+                    has_param = true;
                 }
             }
-            // printf("Result: %d, %d, %d, %d, %d, %d, %d, %d\n", select, select_subj, where, where_var, where_op, where_val, orderby, orderby_pred);
+            query = plan_load(handle, has_param, param, &plan);
         }
         //If the message is PAUSE turn the collect flag off - useful for debugging and getting snapshots of the pico
         if((read_until == 5) && !(buf_comp(pausemsg, input_buffer, read_until))){
             ms_used = time_us_32();
             printf("Collection paused\nTime: %u\n", ms_used);
             collect = false;
+            //Get the rows staged so far into flash - a snapshot should survive a reset
+            if(FLASH_LOG){
+                flash_log_flush(&flash_log);
+            }
         }
         //If the message is GO turn the collect flag on - useful for allowing the pico to run after a pause
         if((read_until == 2) && !(buf_comp(gomsg, input_buffer, read_until))){
@@ -357,429 +2463,55 @@ int main(){
             printf("Collection resumed\nTime: %u\n", ms_used);
             collect = true;
         }
+        //If the message is STOP drop every standing query, STOP [n] drops just that one
+        if((read_until >= 4) && !(buf_comp(stopmsg, input_buffer, 4))){
+            for(int q = 0; q < MAX_STANDING; q++){
+                if((read_until == 4) || ((read_until > 5) && (input_buffer[5] - 48 == q))){
+                    standing[q].active = false;
+                }
+            }
+            printf("Standing queries stopped\n");
+        }
+        //If the message is STATS send where the time has gone since boot or the last STATS RESET
+        if((read_until == 5) && !(buf_comp(statsmsg, input_buffer, read_until))){
+            print_stats();
+        }
+        if((read_until == 11) && !(buf_comp(resetmsg, input_buffer, read_until))){
+            stats_reset();
+            printf("Stats reset\n");
+        }
         //----------------------------------------------------------------------------------------------------
 
         //----------------------------------------------------------------------------------------------------
         //Parse SQL logic
-        if(select){
-            // printf("Parsing\n");
-            struct DataPoint pool[ARRAY_SIZE]; //Super lazy and space-consuming, but that is a later fix
-            int count = 0;
-            //Test for funzies
-            // pool[0] = data[0];
-            // printf("%lu:%lu; %d:%d; %d:%d; %d:%d\n", pool[0].ms_time, data[0].ms_time, pool[0].potentiometer_value, 
-            // data[0].potentiometer_value, pool[0].button_pressed, data[0].button_pressed, pool[0].led_on, data[0].led_on);
-            if(where){
-                // printf("Interpreting WHERE clause\n");
-                //Interpret the where clause - whereval is given, operator needs to be translated
-                if(where_var == 1000){
-                    if(where_op == 1){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].ms_time < where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 2){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].ms_time > where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 3){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].ms_time == where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 4){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].ms_time <= where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 5){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].ms_time >= where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 6){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].ms_time != where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                }
-                else if(where_var == 100){
-                    if(where_op == 1){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].potentiometer_value < where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 2){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].potentiometer_value > where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 3){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].potentiometer_value == where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 4){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].potentiometer_value <= where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 5){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].potentiometer_value >= where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 6){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].potentiometer_value != where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                }
-                else if(where_var == 10){
-                    if(where_op == 1){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].button_pressed < where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 2){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].button_pressed > where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 3){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].button_pressed == where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 4){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].button_pressed <= where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 5){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].button_pressed >= where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 6){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].button_pressed != where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                }
-                else if(where_var == 1){
-                    if(where_op == 1){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].led_on < where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 2){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].led_on > where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 3){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].led_on == where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 4){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].led_on <= where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 5){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].led_on >= where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                    if(where_op == 6){
-                        for(int i = 0; i < arr_len; i++){
-                            if(data[i].led_on != where_val){
-                                pool[i].ms_time = data[i].ms_time;
-                                pool[i].potentiometer_value = data[i].potentiometer_value;
-                                pool[i].button_pressed = data[i].button_pressed;
-                                pool[i].led_on = data[i].led_on;
-                                count ++;
-                            }
-                        }
-                    }
-                }
-            }
-            else{
-                // printf("Skipping WHERE clause\n");
-                count = arr_len;
-                for(int i = 0; i < arr_len; i++){
-                    pool[i].ms_time = data[i].ms_time;
-                    pool[i].potentiometer_value = data[i].potentiometer_value;
-                    pool[i].button_pressed = data[i].button_pressed;
-                    pool[i].led_on = data[i].led_on;
-                }
-            }
-            if(orderby){
-                // printf("Interpreting ORDER BY\n");
-                //I am not sure how to do mappings, so I guess I am just going to have to repeat myself a bunch of times again
-                if((orderby_pred % 10) == 1){
-                    qsort(pool, count, sizeof(struct DataPoint), &compareDPLed);
-                }
-                else if((orderby_pred % 100) >= 10){
-                    qsort(pool, count, sizeof(struct DataPoint), &compareDPBut);
-                }
-                else if((orderby_pred % 1000) >= 100){
-                    qsort(pool, count, sizeof(struct DataPoint), &compareDPPot);
-                }
-                else if(orderby_pred >= 1000){
-                    qsort(pool, count, sizeof(struct DataPoint), &compareDPTime);
-                }
-            }
-            else{
-                // printf("Skipping ORDER BY\n");
-            }
-            //Projection last - actually printed
-            printf("Projecting over array size %d\n", count);
-            //Printing headers
-            if(select_subj >= 1000){
-                printf("time");
-                if((select_subj - 1000) > 0){
-                    printf(", ");
-                }
-            }
-            if((select_subj % 1000) >= 100){
-                printf("potv");
-                if(((select_subj % 1000) - 100) > 0){
-                    printf(", ");
-                }
-            }
-            if((select_subj % 100) >= 10){
-                printf("butp");
-                if(((select_subj % 100) - 10) > 0){
-                    printf(", ");
-                }
-            }
-            if((select_subj % 10) == 1){
-                printf("ledo");
-            }
-            printf("\n");
-            for(int i = 0; i < count; i ++){
-                struct DataPoint point = pool[i];
-                if(select_subj >= 1000){
-                    printf("%u", point.ms_time);
-                    if((select_subj - 1000) > 0){
-                        printf(", ");
-                    }
-                }
-                if((select_subj % 1000) >= 100){
-                    printf("%u", point.potentiometer_value);
-                    if(((select_subj % 1000) - 100) > 0){
-                        printf(", ");
-                    }
-                }
-                if((select_subj % 100) >= 10){
-                    printf("%d", point.button_pressed);
-                    if(((select_subj % 100) - 10) > 0){
-                        printf(", ");
-                    }
-                }
-                if((select_subj % 10) == 1){
-                    printf("%d", point.led_on);
-                }
-                printf("\n");
-            }
-            uint32_t query_time = time_us_32() - loop_start;
-            printf("Time to query: %u\n", query_time);
-        }
-        //After all the logic is done, reset the values so that the logic is only parsed once per new SQL statement
-        select = false;
-        select_subj = 0;
-        where = false;
-        where_var = 0;
-        where_op = 0; //0 - x, 1 - <, 2 - >, 3 - =, 4 - <=, 5 - >=, 6 - <>
-        where_val = 0;
-        orderby = false;
-        orderby_pred = 0;
+        //The executor only looks at the plan - the SQL text was dealt with when it came in
+        if(query){
+            run_plan(&plan, loop_start);
+        }
+        //After all the logic is done, reset so that the plan is only run once per new SQL statement
+        query = false;
         //----------------------------------------------------------------------------------------------------
 
         //----------------------------------------------------------------------------------------------------
-        //Collect data from the Pico
-        if(collect){
-            data[loop_var].potentiometer_value = adc_read();            // Read potentiometer
-            data[loop_var].button_pressed = gpio_get(BUTTON_PIN) == 0;  // Read button (active low)
-            data[loop_var].led_on = true;                               // Set the value of the led to either boolean variable
-            data[loop_var].ms_time = time_us_32();                       // Read the timestamp in ms since the start of the program
+        //Move the samples core1 (or the ADC DMA) has taken since last loop into the table
+        struct DataPoint point;
+        while(sample_ring_pop(&samples, &point)){
+            table_insert(point);
+        }
+        if(ADC_DMA_HZ > 0){
+            adc_stream_drain(&adc_stream, ingest_sample);
+        }
+        //----------------------------------------------------------------------------------------------------
 
-            //Code for displaying new data collected
-            // printf("Reading %d: Potentiometer = %u, Button = %s\n", 
-            //        loop_var, 
-            //        data[loop_var].potentiometer_value, 
-            //        data[loop_var].button_pressed ? "Pressed" : "Released");
-
-            //Go to the next loop value
-            loop_var ++;
-            num_samples ++;
-            cur_variance_sum = 0;
-            if(num_samples >= ARRAY_SIZE){
-                //Delete a value which is where the loop_var will insert the new value - point with the smallest distance from the mean
-
-                //Calculate the mean
-                double pot_sum = data[0].potentiometer_value;
-                for(int i = 1; i < ARRAY_SIZE; i++){
-                    pot_sum += data[i].potentiometer_value;
-                }
-                double mean = pot_sum / ARRAY_SIZE;
-                //Find the last closest value 
-                int idx = 0;
-                double distance = abs(data[0].potentiometer_value - mean);
-                cur_variance_sum += distance;
-                for(int i = 1; i < ARRAY_SIZE; i++){
-                    double cur_dist = abs(data[i].potentiometer_value - mean);
-                    if(cur_dist <= distance){
-                        idx = i;
-                        distance = cur_dist;
-                    }
-                    cur_variance_sum += cur_dist;
-                }
-                loop_var = idx; //Doesn't technically delete it, but will replace the values in data[loop_var] so it is good enough
-            }
+        //----------------------------------------------------------------------------------------------------
+        //Send the next slice of any result in flight - it gets whatever is left of QUERY_BUDGET_US this loop
+        if(cursor.kind != CURSOR_IDLE){
+            uint32_t output_start = time_us_32();
+            cursor_step(loop_start + QUERY_BUDGET_US);
+            stat_add(&stats.phase[STAT_OUTPUT], time_us_32() - output_start);
         }
+        //Rows still in the TX buffer go on draining into USB while the loop sleeps
+        tx_pump(&tx);
         //----------------------------------------------------------------------------------------------------
 
         //----------------------------------------------------------------------------------------------------
@@ -788,8 +2520,20 @@ int main(){
         gpio_put(LED_PIN, false);
         loop_end = time_us_32();
         loop_time = loop_end - loop_start;
+        stat_add(&stats.phase[STAT_LOOP], loop_time);
+        if(loop_time > MS_SERVE_LOOP * 1000){
+            stats.overruns ++;
+        }
         //----------------------------------------------------------------------------------------------------
-        sleep_ms(MS_BT_LOOP);
+        //Sleep out the rest of the MS_SERVE_LOOP period - cut short when a command comes in, or when one is waiting in the
+        //RX queue and there is no result in its way
+        int32_t time_left = MS_SERVE_LOOP * 1000 - (int32_t) loop_time;
+        bool waiting = (rx_queue.count > 0) && (cursor.kind == CURSOR_IDLE);
+        while((time_left > 0) && (rx_ring_count(&rx) == 0) && !waiting){
+            sleep_us((time_left < 1000) ? time_left : 1000);
+            tx_pump(&tx);
+            time_left = MS_SERVE_LOOP * 1000 - (int32_t)(time_us_32() - loop_start);
+        }
     }
 
     return(0);
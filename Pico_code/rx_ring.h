@@ -0,0 +1,153 @@
+#ifndef RX_RING_H
+#define RX_RING_H
+
+// Serial receive path - the USB stdio callback drops bytes into a ring as they arrive and the main loop cuts commands out of it
+// Commands end at a newline (or carriage return), so the Pi can send several in one write and they are run in order
+// A command with no newline at all is taken once the line has been quiet for RX_IDLE_US, which is how the Pi used to send them
+// Once a newline has come in the sender is known to end its commands, and a pause in the middle of one no longer cuts it short
+// Same single-producer single-consumer scheme as sample_ring.h - the producer is the USB interrupt, the consumer the main loop
+// Whole commands are moved on into an RxQueue straight away, so the ring is free for more input while they wait their turn
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RX_RING_SIZE 1024       // Must be a power of two
+#define RX_LINE_MAX 512         // Longest command, not counting the newline
+#define RX_IDLE_US 2000         // Quiet time that ends a command sent without a newline
+#define RX_TOO_LONG (-2)        // rx_next_command - the command was longer than RX_LINE_MAX and has been thrown away
+#define RX_QUEUE_SIZE 2048      // Bytes of commands waiting to run - must be a power of two
+
+struct RxRing {
+    _Atomic uint32_t head;      // Next byte to write - free running, only the low bits index bytes
+    _Atomic uint32_t tail;      // Next byte to read
+    _Atomic uint32_t dropped;   // Bytes thrown away because the ring was full
+    _Atomic uint32_t last_rx;   // time_us_32() of the last byte in
+    uint8_t bytes[RX_RING_SIZE];
+};
+
+// Consumer side line being put together
+struct RxLine {
+    char buf[RX_LINE_MAX + 1];  // Always NUL terminated
+    int len;
+    bool overflow;              // Past RX_LINE_MAX - the rest of the command is skipped
+    bool newlines;              // A newline has been seen - from then on only a newline ends a command
+};
+
+static inline void rx_ring_init(struct RxRing *ring, struct RxLine *line){
+    atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->dropped, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->last_rx, 0, memory_order_relaxed);
+    line->len = 0;
+    line->overflow = false;
+    line->newlines = false;
+    line->buf[0] = 0;
+}
+
+// Producer side - false (and the byte counted as dropped) when the ring is full
+static inline bool rx_ring_put(struct RxRing *ring, uint8_t byte, uint32_t now){
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    atomic_store_explicit(&ring->last_rx, now, memory_order_relaxed);
+    if(head - tail == RX_RING_SIZE){
+        uint32_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        atomic_store_explicit(&ring->dropped, dropped + 1, memory_order_relaxed);
+        return false;
+    }
+    ring->bytes[head & (RX_RING_SIZE - 1)] = byte;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Bytes waiting to be looked at
+static inline uint32_t rx_ring_count(struct RxRing *ring){
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
+
+// Consumer side - moves bytes into line until a command is complete and returns its length, or -1 if there is none yet
+// Empty lines (the \n of a \r\n) are skipped
+static inline int rx_next_command(struct RxRing *ring, struct RxLine *line, uint32_t now){
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    while(tail != head){
+        char c = ring->bytes[tail & (RX_RING_SIZE - 1)];
+        tail++;
+        if((c == '\n') || (c == '\r')){
+            line->newlines = true;
+            int len = line->overflow ? RX_TOO_LONG : line->len;
+            line->len = 0;
+            line->overflow = false;
+            if(len != 0){
+                atomic_store_explicit(&ring->tail, tail, memory_order_release);
+                return len;
+            }
+        }
+        else if(line->len < RX_LINE_MAX){
+            line->buf[line->len++] = c;
+            line->buf[line->len] = 0;
+        }
+        else{
+            line->overflow = true;
+        }
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    //No newline yet - from a sender that never sends one, the command is done once nothing has come in for RX_IDLE_US
+    uint32_t last_rx = atomic_load_explicit(&ring->last_rx, memory_order_relaxed);
+    if(!line->newlines && ((line->len > 0) || line->overflow) && ((int32_t)(now - last_rx) >= RX_IDLE_US)){
+        int len = line->overflow ? RX_TOO_LONG : line->len;
+        line->len = 0;
+        line->overflow = false;
+        return len;
+    }
+    return -1;
+}
+
+// Commands cut out of the ring that have not run yet - main loop only, so nothing here is atomic
+// Each one is its length in two bytes (RX_TOO_LONG for one that was thrown away) and then its text
+struct RxQueue {
+    uint32_t head;              // Next byte to write - free running like RxRing
+    uint32_t tail;              // Next byte to read
+    int count;                  // Commands waiting
+    uint8_t bytes[RX_QUEUE_SIZE];
+};
+
+static inline void rx_queue_init(struct RxQueue *queue){
+    queue->head = 0;
+    queue->tail = 0;
+    queue->count = 0;
+}
+
+// Room for the longest command - nothing more is taken out of the ring until there is
+static inline bool rx_queue_room(const struct RxQueue *queue){
+    return RX_QUEUE_SIZE - (queue->head - queue->tail) >= RX_LINE_MAX + 2;
+}
+
+// Only call when rx_queue_room - len is a length from rx_next_command, cmd is only read when it is not RX_TOO_LONG
+static inline void rx_queue_push(struct RxQueue *queue, const char *cmd, int len){
+    uint16_t stored = (uint16_t) len;
+    queue->bytes[queue->head++ & (RX_QUEUE_SIZE - 1)] = stored & 0xFF;
+    queue->bytes[queue->head++ & (RX_QUEUE_SIZE - 1)] = stored >> 8;
+    for(int i = 0; i < len; i++){
+        queue->bytes[queue->head++ & (RX_QUEUE_SIZE - 1)] = cmd[i];
+    }
+    queue->count++;
+}
+
+// Oldest command into buf (RX_LINE_MAX + 1 bytes, NUL terminated) and its length, or -1 if none is waiting
+static inline int rx_queue_pop(struct RxQueue *queue, char *buf){
+    if(queue->count == 0){
+        return -1;
+    }
+    uint16_t stored = queue->bytes[queue->tail++ & (RX_QUEUE_SIZE - 1)];
+    stored |= queue->bytes[queue->tail++ & (RX_QUEUE_SIZE - 1)] << 8;
+    int len = (int16_t) stored;
+    for(int i = 0; i < len; i++){
+        buf[i] = queue->bytes[queue->tail++ & (RX_QUEUE_SIZE - 1)];
+    }
+    buf[(len > 0) ? len : 0] = 0;
+    queue->count--;
+    return len;
+}
+
+#endif
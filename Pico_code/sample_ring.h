@@ -0,0 +1,55 @@
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+// Single-producer single-consumer ring that carries samples from the sampling core to the core that owns the table
+// No locks - head is only written by the producer and tail only by the consumer, each published with a release store
+// Only plain C11 atomics, so it builds the same on the Pico and on Linux with two threads
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "datapoint.h"
+
+#define SAMPLE_RING_SIZE 64     // Must be a power of two - 6.4 s of samples at the default MS_BT_LOOP
+
+struct SampleRing {
+    _Atomic uint32_t head;      // Next slot to write - free running, only the low bits index slots
+    _Atomic uint32_t tail;      // Next slot to read
+    _Atomic uint32_t dropped;   // Samples thrown away because the consumer fell a whole ring behind
+    struct DataPoint slots[SAMPLE_RING_SIZE];
+};
+
+static inline void sample_ring_init(struct SampleRing *ring){
+    atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->dropped, 0, memory_order_relaxed);
+}
+
+// Producer side - false (and the sample counted as dropped) when the ring is full
+static inline bool sample_ring_push(struct SampleRing *ring, struct DataPoint point){
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if(head - tail == SAMPLE_RING_SIZE){
+        //Only the producer writes dropped, so a load and store is enough - the RP2040 has no atomic read-modify-write
+        uint32_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        atomic_store_explicit(&ring->dropped, dropped + 1, memory_order_relaxed);
+        return false;
+    }
+    ring->slots[head & (SAMPLE_RING_SIZE - 1)] = point;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Consumer side - false when there is nothing to take
+static inline bool sample_ring_pop(struct SampleRing *ring, struct DataPoint *point){
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if(head == tail){
+        return false;
+    }
+    *point = ring->slots[tail & (SAMPLE_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Always-on counters behind the STATS command - where core0's time goes, phase by phase
+// Every phase keeps a count, a total, a maximum and a histogram of power of two microsecond buckets, which is a few adds
+// and a count-leading-zeros per measurement, so they can stay on in production
+// Only core0 writes them; nothing in here knows about the Pico
+
+#include <stdint.h>
+
+#define STAT_SERIAL 0   // Taking a command out of the RX ring
+#define STAT_PARSE 1    // compile_query
+#define STAT_FILTER 2   // WHERE - filling sel from an index, the zone maps or the whole table
+#define STAT_SORT 3     // ORDER BY
+#define STAT_OUTPUT 4   // Cursor slices - projecting, aggregating, formatting and sending rows
+#define STAT_INGEST 5   // table_insert, not counting eviction
+#define STAT_EVICT 6    // Picking the row the next sample overwrites
+#define STAT_LOOP 7     // A whole core0 loop
+#define STAT_QUERY 8    // A whole result, from the command coming in to its trailer going out
+#define NUM_STATS 9
+
+#define STAT_BUCKETS 20     // Bucket b counts times of at least 2^(b-1) and under 2^b us (bucket 0 is 0 us) - the last takes everything from ~0.26 s
+
+struct StatHist {
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[STAT_BUCKETS];
+};
+
+struct Stats {
+    uint32_t since;             // time_us_32 when they were last reset
+    struct StatHist phase[NUM_STATS];
+    uint32_t overruns;          // Loops that took longer than their period
+    uint64_t rows_scanned;      // Rows the WHERE clause had to look at - candidates from an index or zone, or rows decoded by a scan
+    uint64_t rows_returned;     // Rows that passed it
+    uint32_t snap_rows;         // Rows copied into the snapshot overlay before ingest overwrote them
+    uint32_t snaps_too_old;     // Results cut off because the overlay filled up
+};
+
+static inline void stat_add(struct StatHist *hist, uint32_t us){
+    int b = (us == 0) ? 0 : 32 - __builtin_clz(us);
+    hist->buckets[(b < STAT_BUCKETS) ? b : STAT_BUCKETS - 1] ++;
+    hist->count ++;
+    hist->total += us;
+    if(us > hist->max){
+        hist->max = us;
+    }
+}
+
+#endif
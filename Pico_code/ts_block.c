@@ -0,0 +1,154 @@
+#include <string.h>
+#include "ts_block.h"
+
+#define TS_STREAM_BITS ((int)(8 * (TS_BLOCK_BYTES - sizeof(struct TsBlockHeader))))
+
+//Bit stream - least significant bit first, up to 32 bits at a time
+static void put_bits(struct TsBlock *block, uint32_t value, int width){
+    for(int b = 0; b < width; b++){
+        uint32_t pos = block->header.bit_len++;
+        if((value >> b) & 1){
+            block->stream[pos >> 3] |= 1 << (pos & 7);
+        }
+    }
+}
+
+static uint32_t get_bits(struct TsReader *reader, int width){
+    uint32_t value = 0;
+    for(int b = 0; b < width; b++){
+        uint32_t pos = reader->bit_pos++;
+        value |= (uint32_t)((reader->block->stream[pos >> 3] >> (pos & 7)) & 1) << b;
+    }
+    return value;
+}
+
+//Count of 1 bits before a 0, stopping at max - the prefix that picks a code's width
+static int get_prefix(struct TsReader *reader, int max){
+    int ones = 0;
+    while((ones < max) && get_bits(reader, 1)){
+        ones ++;
+    }
+    return ones;
+}
+
+static inline uint32_t zigzag(int32_t v){
+    return ((uint32_t) v << 1) ^ (uint32_t)(v >> 31);
+}
+static inline int32_t unzigzag(uint32_t z){
+    return (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+}
+
+//Delta-of-delta codes: 0 | 10 + 8 bits | 110 + 12 bits | 1110 + 16 bits | 1111 + 32 bits, of the zigzagged change
+static const int time_widths[] = {0, 8, 12, 16, 32};
+//potv delta codes: 0 | 10 + 6 bits | 110 + 9 bits of the zigzagged change | 111 + the 12-bit value itself
+static const int potv_widths[] = {0, 6, 9, 12};
+
+static void put_code(struct TsBlock *block, const int *widths, int num_widths, uint32_t z){
+    int w = 0;
+    while((w < num_widths - 1) && (widths[w] < 32) && (z >> widths[w]) != 0){
+        w ++;
+    }
+    put_bits(block, (1u << w) - 1, w);
+    if(w < num_widths - 1){
+        put_bits(block, 0, 1);
+    }
+    put_bits(block, z, widths[w]);
+}
+
+void ts_store_init(struct TsStore *store, struct TsBlock *blocks, uint32_t num_blocks){
+    store->blocks = blocks;
+    store->num_blocks = num_blocks;
+    store->sealed = 0;
+    memset(&blocks[0], 0, sizeof(struct TsBlock));
+}
+
+void ts_store_append(struct TsStore *store, struct DataPoint point){
+    struct TsBlock *block = &store->blocks[store->sealed % store->num_blocks];
+    uint16_t potv = point.potentiometer_value & 0xFFF;
+    uint8_t flags = point.button_pressed | (point.led_on << 1);
+    point.potentiometer_value = potv;
+    if(block->header.bit_len + TS_SAMPLE_MAX_BITS > TS_STREAM_BITS){
+        store->sealed ++;
+        block = &store->blocks[store->sealed % store->num_blocks];
+        memset(block, 0, sizeof(*block));
+    }
+    if(block->header.count == 0){
+        //First sample of a block is stored whole, so every block decodes on its own
+        block->header.time_first = point.ms_time;
+        block->header.potv_first = potv;
+        block->header.flags_first = flags;
+        store->prev_delta = 0;
+    }
+    else{
+        uint32_t delta = point.ms_time - store->prev_time;
+        put_code(block, time_widths, 5, zigzag((int32_t)(delta - store->prev_delta)));
+        store->prev_delta = delta;
+        int32_t change = (int32_t) potv - store->prev_potv;
+        if(zigzag(change) >> 9){
+            //Too big a jump for a delta to save anything - the value itself
+            put_bits(block, 7, 3);
+            put_bits(block, potv, 12);
+        }
+        else{
+            put_code(block, potv_widths, 4, zigzag(change));
+        }
+        if(flags == store->prev_flags){
+            put_bits(block, 0, 1);
+        }
+        else{
+            put_bits(block, 1 | (flags << 1), 3);
+        }
+    }
+    row_summary_add(&block->header.summary, point, block->header.count == 0);
+    block->header.count ++;
+    store->prev_time = point.ms_time;
+    store->prev_potv = potv;
+    store->prev_flags = flags;
+}
+
+bool ts_store_get(const struct TsStore *store, uint32_t n, struct TsBlock *block){
+    if((n < ts_store_oldest(store)) || (n > store->sealed)){
+        return false;
+    }
+    *block = store->blocks[n % store->num_blocks];
+    return block->header.count > 0;
+}
+
+void ts_reader_init(struct TsReader *reader, const struct TsBlock *block){
+    reader->block = block;
+    reader->bit_pos = 0;
+    reader->next = 0;
+}
+
+struct DataPoint ts_reader_next(struct TsReader *reader){
+    const struct TsBlockHeader *header = &reader->block->header;
+    if(reader->next == 0){
+        reader->prev_time = header->time_first;
+        reader->prev_delta = 0;
+        reader->prev_potv = header->potv_first;
+        reader->prev_flags = header->flags_first;
+    }
+    else{
+        int w = get_prefix(reader, 4);
+        reader->prev_delta += unzigzag(get_bits(reader, time_widths[w]));
+        reader->prev_time += reader->prev_delta;
+        w = get_prefix(reader, 3);
+        uint32_t z = get_bits(reader, potv_widths[w]);
+        if(w == 3){
+            reader->prev_potv = z;
+        }
+        else{
+            reader->prev_potv += unzigzag(z);
+        }
+        if(get_bits(reader, 1)){
+            reader->prev_flags = get_bits(reader, 2);
+        }
+    }
+    reader->next ++;
+    struct DataPoint point;
+    point.ms_time = reader->prev_time;
+    point.potentiometer_value = reader->prev_potv;
+    point.button_pressed = reader->prev_flags & 1;
+    point.led_on = (reader->prev_flags >> 1) & 1;
+    return point;
+}
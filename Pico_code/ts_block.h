@@ -0,0 +1,75 @@
+#ifndef TS_BLOCK_H
+#define TS_BLOCK_H
+
+// Compressed time-series blocks - samples sealed into fixed 256 byte blocks in SRAM, about 2 bytes a sample instead of the
+// 16 a table row costs once its indexes are counted
+// Timestamps are stored as the change in the gap between samples (delta-of-delta), which is 0 or a few bits when sampling
+// keeps its period; potv as the change from the sample before; the button and LED bits only when they change
+// Every field is a variable-length code whose prefix gives the width, so nothing can be found without decoding from the
+// start of the block - scans read a block at a time with a TsReader, and the RowSummary in front lets them skip whole blocks
+// The blocks form a ring, the oldest block is dropped when a new one is started. Nothing in here knows about the Pico
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "datapoint.h"
+
+#define TS_BLOCK_BYTES 256
+#define TS_SAMPLE_MAX_BITS 54       // Widest a sample can encode to - 36 time, 15 potv, 3 flags
+
+struct TsBlockHeader {
+    struct RowSummary summary;
+    uint32_t time_first;        // First sample, stored whole
+    uint16_t potv_first;
+    uint16_t count;             // Samples in the block
+    uint16_t bit_len;           // Bits of stream used
+    uint8_t flags_first;        // butp | ledo << 1
+    uint8_t pad;
+};
+
+struct TsBlock {
+    struct TsBlockHeader header;
+    uint8_t stream[TS_BLOCK_BYTES - sizeof(struct TsBlockHeader)];
+};
+_Static_assert(sizeof(struct TsBlock) == TS_BLOCK_BYTES, "Blocks are a fixed size");
+
+// Ring of blocks - block n (counting every block ever started) lives in blocks[n % num_blocks], the last one still open
+struct TsStore {
+    struct TsBlock *blocks;
+    uint32_t num_blocks;
+    uint32_t sealed;            // Blocks finished so far - block `sealed` is the open one
+    uint32_t prev_time;         // Last sample appended, to encode the next one against
+    uint32_t prev_delta;
+    uint16_t prev_potv;
+    uint8_t prev_flags;
+};
+
+// Decoding position in one block
+struct TsReader {
+    const struct TsBlock *block;
+    uint32_t bit_pos;
+    int next;                   // Samples read so far
+    uint32_t prev_time;
+    uint32_t prev_delta;
+    uint16_t prev_potv;
+    uint8_t prev_flags;
+};
+
+void ts_store_init(struct TsStore *store, struct TsBlock *blocks, uint32_t num_blocks);
+
+// Encode a sample into the open block, sealing it and starting the next (over the oldest) when the sample might not fit
+void ts_store_append(struct TsStore *store, struct DataPoint point);
+
+// Block number of the oldest block still held
+static inline uint32_t ts_store_oldest(const struct TsStore *store){
+    return (store->sealed >= store->num_blocks) ? store->sealed - store->num_blocks + 1 : 0;
+}
+
+// Copy block n out - false if it has been dropped, is not started yet, or has no samples
+bool ts_store_get(const struct TsStore *store, uint32_t n, struct TsBlock *block);
+
+void ts_reader_init(struct TsReader *reader, const struct TsBlock *block);
+
+// Next sample of the block - only call it block->header.count times
+struct DataPoint ts_reader_next(struct TsReader *reader);
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef TX_BUF_H
+#define TX_BUF_H
+
+// Text result rows - formatted straight into a TX block with a hand-rolled integer formatter and handed to the USB driver in
+// packet-sized writes, instead of one printf per field with its format parsing, stdio locking and USB write each time
+// Double buffered: rows go into one block while the other is fed to the driver as fast as its FIFO empties, so formatting
+// only waits on USB when both blocks are full
+// Anything that goes out some other way (printf, binary frames) has to tx_flush first to keep the bytes in order
+// Rows that must not go out yet (in the middle of another result) can wait in a TxHold and be passed on later in order
+// Nothing in here knows about the Pico - the driver is reached through room and write
+
+#include <stdint.h>
+
+#define TX_BLOCK 2048           // Bytes per block
+#define TX_ROW_MAX 160          // Most a row can take - a block is passed on when less than this is left
+#define TX_PACKET 64            // USB full-speed bulk packet - writes are whole packets unless they finish a block
+#define TX_HOLD 2048            // Bytes of rows a TxHold keeps back
+
+struct TxBuf {
+    char blocks[2][TX_BLOCK];
+    int fill;                   // Block rows are going into
+    int len;                    // Bytes in it
+    const char *pending;        // What is left of the other block, still to go to the driver
+    int pending_len;
+    uint32_t (*room)(void);                     // Bytes the driver can take right now without waiting
+    void (*write)(const char *buf, int len);    // Give bytes to the driver - waits for room if it has to
+};
+
+static inline void tx_init(struct TxBuf *tx, uint32_t (*room)(void), void (*write)(const char*, int)){
+    tx->fill = 0;
+    tx->len = 0;
+    tx->pending_len = 0;
+    tx->room = room;
+    tx->write = write;
+}
+
+// Make the block being filled the pending one - whatever was still pending goes out first, waiting if it has to
+static inline void tx_swap(struct TxBuf *tx){
+    if(tx->pending_len > 0){
+        tx->write(tx->pending, tx->pending_len);
+    }
+    tx->pending = tx->blocks[tx->fill];
+    tx->pending_len = tx->len;
+    tx->fill ^= 1;
+    tx->len = 0;
+}
+
+// Feed the driver as much as it can take without waiting, in whole packets - never blocks
+// With nothing pending, a part-filled block is passed on so rows do not sit in it
+static inline void tx_pump(struct TxBuf *tx){
+    if((tx->pending_len == 0) && (tx->len > 0)){
+        tx_swap(tx);
+    }
+    if(tx->pending_len == 0){
+        return;
+    }
+    int n = tx->room();
+    if(n < tx->pending_len){
+        n -= n % TX_PACKET;
+    }
+    else{
+        n = tx->pending_len;
+    }
+    if(n > 0){
+        tx->write(tx->pending, n);
+        tx->pending += n;
+        tx->pending_len -= n;
+    }
+}
+
+// Everything out to the driver - before anything is sent that does not go through here
+static inline void tx_flush(struct TxBuf *tx){
+    if(tx->len > 0){
+        tx_swap(tx);
+    }
+    if(tx->pending_len > 0){
+        tx->write(tx->pending, tx->pending_len);
+        tx->pending_len = 0;
+    }
+}
+
+// Start of a row - room for TX_ROW_MAX bytes from the returned pointer, passed back to tx_end once they are written
+static inline char *tx_begin(struct TxBuf *tx){
+    if(tx->len + TX_ROW_MAX > TX_BLOCK){
+        tx_swap(tx);
+    }
+    return tx->blocks[tx->fill] + tx->len;
+}
+
+static inline void tx_end(struct TxBuf *tx, char *end){
+    tx->len = end - tx->blocks[tx->fill];
+    //Keep the driver busy while rows are still being formatted
+    if(tx->pending_len > 0){
+        tx_pump(tx);
+    }
+}
+
+// Rows kept back until they can go out - once it is full further rows are dropped and counted instead
+struct TxHold {
+    char bytes[TX_HOLD];
+    int len;
+    uint32_t dropped;           // Rows that did not fit since the last tx_hold_release
+};
+
+// Start of a held row, like tx_begin - NULL (and the row counted as dropped) when there is no room for TX_ROW_MAX bytes
+static inline char *tx_hold_begin(struct TxHold *hold){
+    if(hold->len + TX_ROW_MAX > TX_HOLD){
+        hold->dropped++;
+        return NULL;
+    }
+    return hold->bytes + hold->len;
+}
+
+static inline void tx_hold_end(struct TxHold *hold, char *end){
+    hold->len = end - hold->bytes;
+}
+
+// Everything held goes into tx behind what is already there, TX_ROW_MAX bytes at a time
+static inline void tx_hold_release(struct TxBuf *tx, struct TxHold *hold){
+    for(int i = 0; i < hold->len; i += TX_ROW_MAX){
+        int n = (hold->len - i < TX_ROW_MAX) ? hold->len - i : TX_ROW_MAX;
+        char *p = tx_begin(tx);
+        for(int k = 0; k < n; k++){
+            p[k] = hold->bytes[i + k];
+        }
+        tx_end(tx, p + n);
+    }
+    hold->len = 0;
+}
+
+static inline char *fmt_str(char *p, const char *s){
+    while(*s){
+        *p++ = *s++;
+    }
+    return p;
+}
+
+// Decimal digits two at a time out of a 200 byte table, so the divisions are halved
+static const char fmt_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static inline char *fmt_u32(char *p, uint32_t v){
+    char digits[10];
+    int n = 10;
+    while(v >= 100){
+        const char *pair = fmt_pairs + 2 * (v % 100);
+        v /= 100;
+        digits[--n] = pair[1];
+        digits[--n] = pair[0];
+    }
+    if(v >= 10){
+        digits[--n] = fmt_pairs[2 * v + 1];
+        digits[--n] = fmt_pairs[2 * v];
+    }
+    else{
+        digits[--n] = '0' + v;
+    }
+    while(n < 10){
+        *p++ = digits[n++];
+    }
+    return p;
+}
+
+// 64-bit division is slow on a Cortex-M0+, so only values that need it take it
+static inline char *fmt_u64(char *p, uint64_t v){
+    if(v <= UINT32_MAX){
+        return fmt_u32(p, v);
+    }
+    char digits[20];
+    int n = 20;
+    while(v > 0){
+        digits[--n] = '0' + v % 10;
+        v /= 10;
+    }
+    while(n < 20){
+        *p++ = digits[n++];
+    }
+    return p;
+}
+
+#endif